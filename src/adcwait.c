@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Waits for i.MX28 ADC conversions to complete without spinning on the
+ * status register. If the ADC's interrupt is exported through UIO, the wait
+ * sleeps until the interrupt. Otherwise it sleeps for most of the expected
+ * conversion time, learned from earlier conversions, and then polls with
+ * the shortest sleep the system can do between reads, so even conversions
+ * shorter than that never busy-wait a core. Every wait is bounded.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adcwait.h"
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/* Opens /dev/uioN for the UIO device whose name is uio_name */
+static int uio_open(const char *uio_name)
+{
+	DIR *dir;
+	struct dirent *de;
+	char path[300], name[64];
+	int fd = -1;
+	FILE *f;
+
+	dir = opendir("/sys/class/uio");
+	if (dir == NULL)
+		return -1;
+
+	while (fd == -1 && (de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "uio", 3))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/uio/%s/name",
+		  de->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		if (fgets(name, sizeof(name), f)) {
+			name[strcspn(name, "\n")] = '\0';
+			if (strcmp(name, uio_name) == 0) {
+				snprintf(path, sizeof(path), "/dev/%s",
+				  de->d_name);
+				fd = open(path, O_RDWR);
+			}
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return fd;
+}
+
+/* Sets up a wait, using the interrupt of UIO device uio_name if there is
+ * one. uio_name may be NULL to always sleep and poll.
+ */
+int adcwait_open(struct adcwait *w, const char *uio_name)
+{
+	uint64_t t;
+	int i;
+
+	memset(w, 0, sizeof(*w));
+	w->uio_fd = uio_name ? uio_open(uio_name) : -1;
+
+	/* Time the shortest sleep, the poll interval below the estimate */
+	w->sleep_ns = UINT64_MAX;
+	for (i = 0; i < 3; i++) {
+		t = clock_ns(CLOCK_MONOTONIC);
+		sleep_ns(1000);
+		t = clock_ns(CLOCK_MONOTONIC) - t;
+		if (t < w->sleep_ns)
+			w->sleep_ns = t;
+	}
+
+	return 0;
+}
+
+/* With the interrupt exported, enables it by writing mask to the SET
+ * register set, and remembers the CLR register clr so adcwait_close()
+ * disables it again. Returns 1 if enabled.
+ */
+int adcwait_irq_enable(struct adcwait *w, volatile unsigned int *set,
+  volatile unsigned int *clr, unsigned int mask)
+{
+	if (w->uio_fd == -1)
+		return 0;
+
+	*set = mask;
+	w->irq_clr = clr;
+	w->irq_mask = mask;
+
+	return 1;
+}
+
+/* Waits until all of mask is set in *reg, for up to timeout_us. The
+ * conversion must already have been started. Returns 0, or -1 on timeout.
+ */
+int adcwait(struct adcwait *w, volatile unsigned int *reg, unsigned int mask,
+  int timeout_us)
+{
+	uint64_t start = clock_ns(CLOCK_MONOTONIC), now;
+	uint64_t deadline = start + ((uint64_t)timeout_us * 1000);
+	uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	uint64_t nap = (w->est_ns * 7) / 8;
+	int ret = -1;
+
+	w->waits++;
+
+	if (w->uio_fd != -1) {
+		uint32_t count, unmask = 1;
+		struct pollfd pfd = { .fd = w->uio_fd, .events = POLLIN };
+
+		if (write(w->uio_fd, &unmask, sizeof(unmask)) !=
+		  sizeof(unmask))
+			goto poll_only;
+		for (;;) {
+			w->polls++;
+			if ((*reg & mask) == mask) {
+				ret = 0;
+				break;
+			}
+			now = clock_ns(CLOCK_MONOTONIC);
+			if (now >= deadline)
+				break;
+			if (poll(&pfd, 1, ((deadline - now) / 1000000) + 1) == 1
+			  && read(w->uio_fd, &count, sizeof(count)) ==
+			  sizeof(count)) {
+				w->irqs++;
+				if (write(w->uio_fd, &unmask, sizeof(unmask))
+				  != sizeof(unmask))
+					break;
+			}
+		}
+		goto out;
+	}
+
+poll_only:
+	/* Sleep through most of a typical conversion, a sleep overshoots by
+	 * about sleep_ns
+	 */
+	if (nap > w->sleep_ns) {
+		sleep_ns(nap - w->sleep_ns);
+		w->sleeps++;
+	}
+	for (;;) {
+		w->polls++;
+		if ((*reg & mask) == mask) {
+			ret = 0;
+			break;
+		}
+		now = clock_ns(CLOCK_MONOTONIC);
+		if (now >= deadline)
+			break;
+		/* Asks for 1 us, the timer gives about sleep_ns */
+		sleep_ns(1000);
+		w->sleeps++;
+	}
+
+out:
+	now = clock_ns(CLOCK_MONOTONIC);
+	if (ret == 0) {
+		/* 7/8 old, 1/8 new, seeded by the first conversion */
+		if (w->est_ns == 0)
+			w->est_ns = now - start;
+		else
+			w->est_ns = ((w->est_ns * 7) + (now - start)) / 8;
+	} else {
+		w->timeouts++;
+	}
+	w->wait_ns += now - start;
+	w->cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+
+	return ret;
+}
+
+void adcwait_stats(const struct adcwait *w, const char *prefix, FILE *f)
+{
+	fprintf(f, "%s_wait_mode=%s\n", prefix,
+	  w->uio_fd != -1 ? "irq" : "poll");
+	fprintf(f, "%s_waits=%lu\n", prefix, w->waits);
+	fprintf(f, "%s_timeouts=%lu\n", prefix, w->timeouts);
+	fprintf(f, "%s_irqs=%lu\n", prefix, w->irqs);
+	fprintf(f, "%s_polls=%lu\n", prefix, w->polls);
+	fprintf(f, "%s_sleeps=%lu\n", prefix, w->sleeps);
+	fprintf(f, "%s_wait_us=%llu\n", prefix,
+	  (unsigned long long)(w->wait_ns / 1000));
+	fprintf(f, "%s_cpu_us=%llu\n", prefix,
+	  (unsigned long long)(w->cpu_ns / 1000));
+	fprintf(f, "%s_est_us=%.1f\n", prefix, w->est_ns / 1000.0);
+}
+
+void adcwait_close(struct adcwait *w)
+{
+	if (w->irq_clr)
+		*w->irq_clr = w->irq_mask;
+	w->irq_clr = NULL;
+	if (w->uio_fd != -1)
+		close(w->uio_fd);
+	w->uio_fd = -1;
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __ADCWAIT_H_
+#define __ADCWAIT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A conversion takes microseconds, this only catches a stuck LRADC */
+#define LRADC_TIMEOUT_US	10000
+
+struct adcwait {
+	int uio_fd;			/* -1 to sleep and poll */
+	uint64_t est_ns;		/* Running estimate of a conversion */
+	uint64_t sleep_ns;		/* Shortest sleep the system can do */
+	volatile unsigned int *irq_clr;	/* Disables the IRQ on close */
+	unsigned int irq_mask;
+
+	unsigned long waits, timeouts, irqs, polls, sleeps;
+	uint64_t wait_ns, cpu_ns;
+};
+
+int adcwait_open(struct adcwait *w, const char *uio_name);
+int adcwait_irq_enable(struct adcwait *w, volatile unsigned int *set,
+  volatile unsigned int *clr, unsigned int mask);
+int adcwait(struct adcwait *w, volatile unsigned int *reg, unsigned int mask,
+  int timeout_us);
+void adcwait_stats(const struct adcwait *w, const char *prefix, FILE *f);
+void adcwait_close(struct adcwait *w);
+
+#endif
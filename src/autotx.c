@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Timing for the FPGA's automatic RS-485 TXEN. The FPGA asserts TXEN on a
+ * falling edge of the UART's TX line and starts counter 1, ignoring further
+ * edges until it expires; those are data bits. Counter 2 then runs, and a
+ * falling edge during it is the next frame's start bit and starts counter 1
+ * again. If counter 2 expires, TXEN is released.
+ *
+ * So counter 1 has to expire after the last possible falling edge in a
+ * frame, at the start of the last data or parity bit, and before the next
+ * start bit; the middle of the last stop bit is the centre of that window.
+ * Both counters together must last at least to the end of the last stop
+ * bit, anything beyond that is turnaround time lost on the bus.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "autotx.h"
+
+/* Clocks between a TX edge and the counters seeing it, the input
+ * synchronizer plus the edge detect. Only used by the simulator, as it
+ * delays assert and release equally.
+ */
+#define AUTOTX_SYNC_CLKS	3
+
+/* Computes the counter values for baud and a mode like "8n1", with TXEN
+ * held for guard_ns after the last stop bit. cnt1 is rounded to nearest,
+ * the total is rounded up so TXEN is never released early.
+ */
+int autotx_compute(struct autotx_timing *t, int baud, const char *mode,
+  int guard_ns)
+{
+	uint64_t total;
+
+	if (strlen(mode) != 3 || mode[0] < '5' || mode[0] > '8' ||
+	  strchr("noe", mode[1]) == NULL || strchr("12", mode[2]) == NULL) {
+		fprintf(stderr, "Invalid UART mode setting, %s.\n", mode);
+		return -1;
+	}
+	if (baud < 300 || baud > AUTOTX_CLK_HZ / 4) {
+		fprintf(stderr, "Invalid baud rate, %d.\n", baud);
+		return -1;
+	}
+	if (guard_ns < 0) {
+		fprintf(stderr, "Invalid TXEN guard time, %d.\n", guard_ns);
+		return -1;
+	}
+
+	t->baud = baud;
+	t->data = mode[0] - '0';
+	t->parity = mode[1] == 'n' ? 0 : (mode[1] == 'e' ? 1 : 2);
+	t->stop = mode[2] - '0';
+	t->symsz = 1 + t->data + (t->parity != 0) + t->stop;
+
+	t->cnt1 = (((uint64_t)((2 * t->symsz) - 1) * AUTOTX_CLK_HZ) + baud) /
+	  (2 * (uint64_t)baud);
+	total = (((uint64_t)t->symsz * AUTOTX_CLK_HZ) + baud - 1) / baud;
+	total += (((uint64_t)guard_ns * (AUTOTX_CLK_HZ / 1000000)) + 999) /
+	  1000;
+	if (total > 0xffffff) {
+		fprintf(stderr, "TXEN time too long for the counters\n");
+		return -1;
+	}
+	t->cnt2 = total - t->cnt1;
+
+	return 0;
+}
+
+struct sim_frame {
+	double start, end;
+};
+
+struct sim_txen {
+	uint64_t on, off;
+};
+
+/* Clock on which the counters act on a TX edge at time x */
+static uint64_t sim_sample(double x)
+{
+	return (uint64_t)x + 1 + AUTOTX_SYNC_CLKS;
+}
+
+/* Sends nframes frames with gaps (in bit times) between them through the
+ * TXEN model and checks TXEN covers every one. T is the bit time in FPGA
+ * clocks as the UART actually runs it. Returns 1 if all frames were
+ * covered, the TXEN hold past the last frame goes in hold.
+ */
+static int sim_sequence(const struct autotx_timing *t, double T,
+  const int *vals, const double *gaps, int nframes, double *hold)
+{
+	struct sim_frame frames[4];
+	struct sim_txen txen[4 * 13];
+	int ntxen = 0, active = 0, level = 1;
+	uint64_t t1 = 0;
+	double x = 100.37;
+	int i, j, k;
+
+	for (i = 0; i < nframes; i++) {
+		int bits[13], nbits = 0, ones = 0;
+
+		if (i)
+			x += gaps[i - 1] * T;
+		bits[nbits++] = 0;
+		for (j = 0; j < t->data; j++) {
+			bits[nbits] = (vals[i] >> j) & 1;
+			ones += bits[nbits++];
+		}
+		if (t->parity)
+			bits[nbits++] = (ones & 1) ^ (t->parity == 2);
+		for (j = 0; j < t->stop; j++)
+			bits[nbits++] = 1;
+
+		frames[i].start = x;
+		for (k = 0; k < nbits; k++) {
+			if (level && !bits[k]) {
+				uint64_t e = sim_sample(x + (k * T));
+
+				if (active && e < t1) {
+					/* Counter 1 running, a data bit */
+				} else if (active && e < txen[ntxen - 1].off) {
+					t1 = e + t->cnt1;
+					txen[ntxen - 1].off = t1 + t->cnt2;
+				} else {
+					active = 1;
+					t1 = e + t->cnt1;
+					txen[ntxen].on = e;
+					txen[ntxen++].off = t1 + t->cnt2;
+				}
+			}
+			level = bits[k];
+		}
+		x += nbits * T;
+		frames[i].end = x;
+	}
+
+	/* The start bit is always seen late, but the rest of the frame must
+	 * be under TXEN
+	 */
+	for (i = 0; i < nframes; i++) {
+		uint64_t on = sim_sample(frames[i].start);
+
+		for (j = 0; j < ntxen; j++) {
+			if (txen[j].on <= on && txen[j].off >= frames[i].end)
+				break;
+		}
+		if (j == ntxen)
+			return 0;
+	}
+
+	*hold = (double)txen[ntxen - 1].off - frames[nframes - 1].end;
+
+	return 1;
+}
+
+/* Runs every data value through the model as single frames and in bursts
+ * with back to back, fractional and idle gaps, with the UART's bit time
+ * off nominal by err (0.01 is 1% slow). res->pass is set if TXEN covered
+ * every frame.
+ */
+int autotx_simulate(const struct autotx_timing *t, double err,
+  struct autotx_sim *res)
+{
+	static const double gaps[] = { 0, 0.5, 1.5, 40 };
+	double T = ((double)AUTOTX_CLK_HZ / t->baud) * (1 + err), hold;
+	int mask = (1 << t->data) - 1;
+	int follow[4] = { 0, mask, 0x55 & mask, 0 };
+	int v, f, g, vals[3];
+	double gap[2];
+
+	res->frames = 0;
+	res->pass = 1;
+	res->hold_us = 0;
+
+	for (v = 0; v <= mask; v++) {
+		follow[3] = v;
+		if (!sim_sequence(t, T, &v, NULL, 1, &hold))
+			res->pass = 0;
+		res->frames++;
+		for (f = 0; f < 4; f++) {
+			for (g = 0; g < 4; g++) {
+				vals[0] = v;
+				vals[1] = follow[f];
+				vals[2] = v;
+				gap[0] = gap[1] = gaps[g];
+				if (!sim_sequence(t, T, vals, gap, 3, &hold))
+					res->pass = 0;
+				else if (hold / (AUTOTX_CLK_HZ / 1e6) >
+				  res->hold_us)
+					res->hold_us = hold /
+					  (AUTOTX_CLK_HZ / 1e6);
+				res->frames += 3;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Prints the counters and the simulator's verdict for them, along with the
+ * range of UART baud error, in 0.1% steps, the counters still cover. A UART
+ * running slow needs guard time, one running fast has to start its next
+ * frame after counter 1 expires.
+ */
+int autotx_check(const struct autotx_timing *t, FILE *f)
+{
+	struct autotx_sim res, tol;
+	double slow, fast;
+
+	autotx_simulate(t, 0, &res);
+	for (slow = 0; res.pass && slow < 0.1; slow += 0.001) {
+		autotx_simulate(t, slow + 0.001, &tol);
+		if (!tol.pass)
+			break;
+	}
+	for (fast = 0; res.pass && fast < 0.1; fast += 0.001) {
+		autotx_simulate(t, -(fast + 0.001), &tol);
+		if (!tol.pass)
+			break;
+	}
+
+	fprintf(f, "baud=%d\n", t->baud);
+	fprintf(f, "symbol_bits=%d\n", t->symsz);
+	fprintf(f, "cnt1=%u\n", t->cnt1);
+	fprintf(f, "cnt2=%u\n", t->cnt2);
+	fprintf(f, "sim_frames=%ld\n", res.frames);
+	fprintf(f, "sim_result=%s\n", res.pass ? "pass" : "FAIL");
+	fprintf(f, "txen_hold_us=%.2f\n", res.hold_us);
+	fprintf(f, "baud_tolerance=-%.1f%%,+%.1f%%\n", slow * 100,
+	  fast * 100);
+
+	return res.pass ? 0 : -1;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __AUTOTX_H_
+#define __AUTOTX_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The TXEN counters run from the FPGA's 25 MHz clock */
+#define AUTOTX_CLK_HZ		25000000
+
+struct autotx_timing {
+	int baud;
+	int data, stop;
+	int parity;			/* 0 none, 1 even, 2 odd */
+	int symsz;			/* Bits per frame, start to last stop */
+	uint32_t cnt1, cnt2;
+};
+
+struct autotx_sim {
+	long frames;
+	int pass;
+	double hold_us;			/* TXEN held past the last stop bit */
+};
+
+int autotx_compute(struct autotx_timing *t, int baud, const char *mode,
+  int guard_ns);
+int autotx_simulate(const struct autotx_timing *t, double err,
+  struct autotx_sim *res);
+int autotx_check(const struct autotx_timing *t, FILE *f);
+
+#endif
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "buslock.h"
+#include "bustrace.h"
+
+#define BUSLOCK_PATH		"/run/lock/ts-i2c-0.lock"
+
+/* Most a normal priority process will wait on announced high priority ones,
+ * so a high priority process that is stopped while waiting cannot stall
+ * everyone else indefinitely.
+ */
+#define BUSLOCK_BACKOFF_US	100
+#define BUSLOCK_BACKOFF_MAX	50
+
+/* Waiters announce themselves with a shared fcntl() lock on one of these
+ * bytes of the lock file for as long as they wait, others test for them
+ * with F_GETLK. The kernel drops the record locks of a process that exits
+ * or is killed, so a dead waiter cannot leave itself announced. These are
+ * independent of the flock() on the whole file that is the bus lock.
+ */
+#define BUSLOCK_HI_BYTE		0
+#define BUSLOCK_WAIT_BYTE	1
+
+static int lockfd = -2;
+static int prio_high = -1;
+
+static void buslock_init(void)
+{
+	char *path = getenv("TS_BUS_LOCK");
+	char *prio;
+
+	lockfd = -1;
+	if (prio_high == -1) {
+		prio = getenv("TS_BUS_PRIO");
+		prio_high = (prio && strcmp(prio, "high") == 0);
+	}
+
+	if (path == NULL)
+		path = BUSLOCK_PATH;
+	if (strcmp(path, "none") == 0)
+		return;
+
+	lockfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (lockfd == -1)
+		return;
+	/* umask may have narrowed the mode, every bus user needs write */
+	fchmod(lockfd, 0666);
+}
+
+static void announce(int byte, int on)
+{
+	struct flock fl = {
+		.l_type = on ? F_RDLCK : F_UNLCK,
+		.l_whence = SEEK_SET,
+		.l_start = byte,
+		.l_len = 1,
+	};
+
+	fcntl(lockfd, F_SETLK, &fl);
+}
+
+/* True if another process is announced on byte */
+static int announced(int byte)
+{
+	struct flock fl = {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET,
+		.l_start = byte,
+		.l_len = 1,
+	};
+
+	if (fcntl(lockfd, F_GETLK, &fl) == -1)
+		return 0;
+
+	return fl.l_type != F_UNLCK;
+}
+
+void buslock_set_priority(int high)
+{
+	prio_high = !!high;
+}
+
+void buslock_acquire(void)
+{
+	uint64_t start;
+	int i;
+
+	if (lockfd == -2)
+		buslock_init();
+	if (lockfd == -1)
+		return;
+	start = BUSTRACE_BEGIN();
+
+	if (prio_high) {
+		announce(BUSLOCK_HI_BYTE, 1);
+	} else {
+		for (i = 0; i < BUSLOCK_BACKOFF_MAX &&
+		  announced(BUSLOCK_HI_BYTE); i++)
+			usleep(BUSLOCK_BACKOFF_US);
+	}
+	announce(BUSLOCK_WAIT_BYTE, 1);
+
+	flock(lockfd, LOCK_EX);
+
+	announce(BUSLOCK_WAIT_BYTE, 0);
+	if (prio_high)
+		announce(BUSLOCK_HI_BYTE, 0);
+	if (bustrace_on)
+		bustrace_lock_ns += bustrace_now() - start;
+}
+
+/* flock() wakes waiters in no particular order, so this is not a queue. A
+ * normal priority process only yields when others are waiting, giving them
+ * a chance to be scheduled and take the lock before its next transaction.
+ */
+void buslock_release(void)
+{
+	if (lockfd < 0)
+		return;
+
+	flock(lockfd, LOCK_UN);
+
+	if (!prio_high && announced(BUSLOCK_WAIT_BYTE))
+		sched_yield();
+}
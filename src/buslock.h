@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __BUSLOCK_H_
+#define __BUSLOCK_H_
+
+/* Cross-process arbitration for the shared /dev/i2c-0 bus. Callers hold the
+ * lock around a single transaction only, so critical sections stay short.
+ *
+ * Processes started with TS_BUS_PRIO=high announce themselves while waiting,
+ * and normal priority processes hold off, for a bounded time, while any are
+ * announced. A normal process that sees others waiting when it releases the
+ * lock yields before its next transaction. The lock itself is not FIFO, so
+ * this is best effort: it makes it unlikely, not impossible, for a long run
+ * of transfers to keep others off the bus.
+ *
+ * The lock is /run/lock/ts-i2c-0.lock, or TS_BUS_LOCK if set. TS_BUS_LOCK=none
+ * disables arbitration. If the lock file cannot be opened, arbitration is
+ * silently skipped.
+ */
+void buslock_set_priority(int high);
+void buslock_acquire(void);
+void buslock_release(void);
+
+#endif
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bustrace.h"
+
+int bustrace_on = 0;
+uint64_t bustrace_lock_ns;
+
+static struct bustrace_ent *ring;
+static int ring_size, ring_head;
+static uint64_t ring_total;
+
+static uint64_t stat_xfers, stat_bytes, stat_errors, stat_bus_ns;
+static uint64_t stat_wait_ns;
+
+uint64_t bustrace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Counters are always kept once enabled, the ring only if it has entries */
+int bustrace_enable(int entries)
+{
+	if (entries > 0) {
+		ring = calloc(entries, sizeof(*ring));
+		if (ring == NULL) {
+			perror("bustrace");
+			return -1;
+		}
+		ring_size = entries;
+	}
+	bustrace_on = 1;
+
+	return 0;
+}
+
+void bustrace_record(uint64_t start, uint16_t slave, uint16_t reg,
+  int dir, int len, int err)
+{
+	uint64_t dur = bustrace_now() - start;
+	uint64_t wait = bustrace_lock_ns;
+
+	bustrace_lock_ns = 0;
+	if (wait > dur)
+		wait = dur;
+	start += wait;
+	dur -= wait;
+
+	stat_xfers++;
+	stat_bus_ns += dur;
+	stat_wait_ns += wait;
+	if (err)
+		stat_errors++;
+	else
+		stat_bytes += len;
+
+	if (ring_size) {
+		struct bustrace_ent *e = &ring[ring_head];
+
+		e->ts_ns = start;
+		e->dur_ns = dur > UINT32_MAX ? UINT32_MAX : dur;
+		e->wait_ns = wait > UINT32_MAX ? UINT32_MAX : wait;
+		e->slave = slave;
+		e->reg = reg;
+		e->len = len;
+		e->dir = dir;
+		e->err = !!err;
+		ring_head = (ring_head + 1) % ring_size;
+		ring_total++;
+	}
+}
+
+/* Oldest entry first, timestamps relative to it */
+void bustrace_dump(FILE *f)
+{
+	int i, n, idx;
+	uint64_t t0;
+
+	if (!ring_size)
+		return;
+
+	n = ring_total < ring_size ? ring_total : ring_size;
+	idx = ring_total < ring_size ? 0 : ring_head;
+	if (ring_total > ring_size)
+		fprintf(f, "# %llu older transactions dropped\n",
+		  (unsigned long long)(ring_total - ring_size));
+	fprintf(f, "# %12s %5s %6s %3s %5s %10s %10s %s\n", "time_us",
+	  "slave", "reg", "dir", "len", "dur_us", "wait_us", "err");
+
+	t0 = n ? ring[idx].ts_ns : 0;
+	for (i = 0; i < n; i++) {
+		struct bustrace_ent *e = &ring[(idx + i) % ring_size];
+
+		fprintf(f, "  %12.1f  0x%02X 0x%04X %3s %5d %10.1f %10.1f %s\n",
+		  (e->ts_ns - t0) / 1e3, e->slave, e->reg,
+		  e->dir == BUSTRACE_READ ? "rd" : "wr", e->len,
+		  e->dur_ns / 1e3, e->wait_ns / 1e3, e->err ? "ERR" : "");
+	}
+}
+
+void bustrace_stats(FILE *f)
+{
+	fprintf(f, "bus_transactions=%llu\n", (unsigned long long)stat_xfers);
+	fprintf(f, "bus_bytes=%llu\n", (unsigned long long)stat_bytes);
+	fprintf(f, "bus_errors=%llu\n", (unsigned long long)stat_errors);
+	fprintf(f, "bus_time_us=%llu\n",
+	  (unsigned long long)(stat_bus_ns / 1000));
+	fprintf(f, "bus_lock_wait_us=%llu\n",
+	  (unsigned long long)(stat_wait_ns / 1000));
+}
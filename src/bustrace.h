@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __BUSTRACE_H_
+#define __BUSTRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Per-process record of I2C transactions. Nothing is recorded until
+ * bustrace_enable() is called; until then BUSTRACE_BEGIN/END cost a single
+ * test of bustrace_on per transaction.
+ */
+enum {
+	BUSTRACE_READ,
+	BUSTRACE_WRITE,
+};
+
+struct bustrace_ent {
+	uint64_t ts_ns;		/* CLOCK_MONOTONIC at start, after the lock */
+	uint32_t dur_ns;
+	uint32_t wait_ns;	/* Waiting for the bus lock before ts_ns */
+	uint16_t slave;
+	uint16_t reg;
+	uint16_t len;
+	uint8_t dir;
+	uint8_t err;
+};
+
+extern int bustrace_on;
+
+/* Time buslock_acquire() spent waiting since the last record, it is taken
+ * out of that transaction's duration so dur_ns is only bus time.
+ */
+extern uint64_t bustrace_lock_ns;
+
+uint64_t bustrace_now(void);
+void bustrace_record(uint64_t start, uint16_t slave, uint16_t reg,
+  int dir, int len, int err);
+int bustrace_enable(int entries);
+void bustrace_dump(FILE *f);
+void bustrace_stats(FILE *f);
+
+#define BUSTRACE_BEGIN()	(bustrace_on ? bustrace_now() : 0)
+#define BUSTRACE_END(start, slave, reg, dir, len, err) do { \
+	if (bustrace_on) \
+		bustrace_record(start, slave, reg, dir, len, err); \
+} while (0)
+
+#endif
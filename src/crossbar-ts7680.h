@@ -3,9 +3,9 @@
 
 #ifndef _CROSSBAR_TS7680_H_
 #define _CROSSBAR_TS7680_H_
-#include "fpga.h"
+#include "crossbar.h"
 
-struct cbarpin ts7680_outputs[] = {
+static const struct cbarpin ts7680_outputs[] = {
 	{ 0, "FPGA_22" },
 	{ 1, "FPGA_23" },
 	{ 2, "FPGA_24" },
@@ -44,7 +44,7 @@ struct cbarpin ts7680_outputs[] = {
 	{ 0, 0 },
 };
 
-struct cbarpin ts7680_inputs[] = {
+static const struct cbarpin ts7680_inputs[] = {
 	{ 0, "UNCHANGED" },
 	{ 1, "DC_RXD" },
 	{ 2, "COM1_RXD" },
@@ -3,9 +3,9 @@
 
 #ifndef _CROSSBAR_TS7682_H_
 #define _CROSSBAR_TS7682_H_
-#include "fpga.h"
+#include "crossbar.h"
 
-struct cbarpin ts7682_outputs[] = {
+static const struct cbarpin ts7682_outputs[] = {
 	{ 20, "DC_TXD" },
 	{ 21, "CELL_TXD" },
 	{ 22, "CELL_RTS" },
@@ -24,7 +24,7 @@ struct cbarpin ts7682_outputs[] = {
 	{ 0, 0 },
 };
 
-struct cbarpin ts7682_inputs[] = {
+static const struct cbarpin ts7682_inputs[] = {
 	{ 0, "UNCHANGED" },
 	{ 1, "DC_RXD" },
 	{ 2, "CELL_RXD" },
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crossbar.h"
+#include "fpga.h"
+#include "crossbar-ts7680.h"
+#include "crossbar-ts7682.h"
+#include "crossbar-hash.h"
+
+static const struct cbar_model models[] = {
+	{
+		.model = 0x7680,
+		.outputs = ts7680_outputs,
+		.inputs = ts7680_inputs,
+		.noutputs = TS7680_NOUTPUTS,
+		.ninputs = TS7680_NINPUTS,
+		.size = 6,
+		.mask = 3,
+		.lo = TS7680_PAD_LO,
+		.hi = TS7680_PAD_HI,
+		.input_by_mode = ts7680_input_by_mode,
+		.output_slots = ts7680_outputs_slots,
+		.input_slots = ts7680_inputs_slots,
+		.output_seed = TS7680_OUTPUTS_SEED,
+		.input_seed = TS7680_INPUTS_SEED,
+		.slot_mask = CBAR_SLOTS - 1,
+		.gpio_lo = 0,
+		.gpio_count = 14,	/* FPGA_22 - FPGA_35 */
+	},
+	{
+		.model = 0x7682,
+		.outputs = ts7682_outputs,
+		.inputs = ts7682_inputs,
+		.noutputs = TS7682_NOUTPUTS,
+		.ninputs = TS7682_NINPUTS,
+		.size = 6,
+		.mask = 3,
+		.lo = TS7682_PAD_LO,
+		.hi = TS7682_PAD_HI,
+		.input_by_mode = ts7682_input_by_mode,
+		.output_slots = ts7682_outputs_slots,
+		.input_slots = ts7682_inputs_slots,
+		.output_seed = TS7682_OUTPUTS_SEED,
+		.input_seed = TS7682_INPUTS_SEED,
+		.slot_mask = CBAR_SLOTS - 1,
+		/* No FPGA pads on the TS-7682 */
+	},
+};
+
+const struct cbar_model *cbar_get_model(int model)
+{
+	int i;
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+		if (models[i].model == model)
+			return &models[i];
+	}
+
+	return NULL;
+}
+
+static const struct cbarpin *lookup(const struct cbarpin *table,
+  const int8_t *slots, uint32_t seed, int slot_mask, const char *name)
+{
+	int idx = slots[cbar_hash(seed, name) & slot_mask];
+
+	if (idx < 0 || strcmp(table[idx].name, name) != 0)
+		return NULL;
+
+	return &table[idx];
+}
+
+const struct cbarpin *cbar_find_output(const struct cbar_model *m,
+  const char *name)
+{
+	return lookup(m->outputs, m->output_slots, m->output_seed,
+	  m->slot_mask, name);
+}
+
+const struct cbarpin *cbar_find_input(const struct cbar_model *m,
+  const char *name)
+{
+	return lookup(m->inputs, m->input_slots, m->input_seed,
+	  m->slot_mask, name);
+}
+
+/* NULL for modes past the end of the model's input table */
+const char *cbar_input_name(const struct cbar_model *m, int mode)
+{
+	if (mode < 0 || mode >= CBAR_MODES)
+		return NULL;
+
+	return m->input_by_mode[mode];
+}
+
+/* Samples every GPIO pad with a single block read */
+int cbar_gpio_read(const struct cbar_model *m, int twifd, uint32_t *dir,
+  uint32_t *val)
+{
+	uint8_t regs[32];
+	int i;
+
+	*dir = *val = 0;
+	if (m->gpio_count == 0)
+		return 0;
+
+	if (fpeek_block(twifd, m->gpio_lo, regs, m->gpio_count))
+		return -1;
+
+	for (i = 0; i < m->gpio_count; i++) {
+		*dir |= (uint32_t)(regs[i] & 0x1) << i;
+		*val |= (uint32_t)((regs[i] >> 1) & 0x1) << i;
+	}
+
+	return 0;
+}
+
+/* Stages a pad change in the shadow cache, the caller flushes so several
+ * pads go out in one burst. An input keeps its last output value bit.
+ */
+int cbar_gpio_set(const struct cbar_model *m, int twifd,
+  const struct cbarpin *pad, int out, int val)
+{
+	if (pad->addr < m->gpio_lo ||
+	  pad->addr >= m->gpio_lo + m->gpio_count)
+		return -1;
+
+	if (out)
+		return fpga_cache_rmw(twifd, pad->addr, 0x3,
+		  0x1 | (val ? 0x2 : 0));
+
+	return fpga_cache_rmw(twifd, pad->addr, 0x1, 0);
+}
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __CROSSBAR_H_
+#define __CROSSBAR_H_
+
+#include <stdint.h>
+
+struct cbarpin
+{
+	int addr;
+	const char *name;
+};
+
+/* Everything tshwctl needs to know about one board's FPGA crossbar. The
+ * name lookups use perfect hash tables generated at build time by
+ * mkcrossbar from the crossbar-ts768x.h tables, so each lookup is one hash
+ * and one strcmp.
+ */
+struct cbar_model {
+	int model;
+	const struct cbarpin *outputs;	/* Terminated by a NULL name */
+	const struct cbarpin *inputs;	/* Indexed by mode value */
+	int noutputs, ninputs;
+	int size;			/* Mode field width, top of register */
+	int mask;			/* Bits below the mode field */
+	int lo, hi;			/* Span of pad register addresses */
+	const char *const *input_by_mode;
+	const int8_t *output_slots, *input_slots;
+	uint32_t output_seed, input_seed;
+	int slot_mask;
+	int gpio_lo, gpio_count;	/* GPIO pads, first in outputs */
+};
+
+#define CBAR_MODES		64
+
+/* FNV-1a, seeded so mkcrossbar can search for a collision-free seed. The
+ * final mix folds the high bits down, otherwise the low bits used to pick a
+ * slot would only ever depend on the low bits of the seed.
+ */
+static inline uint32_t cbar_hash(uint32_t seed, const char *s)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+
+	return h;
+}
+
+const struct cbar_model *cbar_get_model(int model);
+const struct cbarpin *cbar_find_output(const struct cbar_model *m,
+  const char *name);
+const struct cbarpin *cbar_find_input(const struct cbar_model *m,
+  const char *name);
+const char *cbar_input_name(const struct cbar_model *m, int mode);
+
+/* FPGA pad GPIO bank. Each pad register holds the direction in bit 0 (1 is
+ * output) and the pad value in bit 1. Bit n of dir/val is pad gpio_lo + n.
+ */
+int cbar_gpio_read(const struct cbar_model *m, int twifd, uint32_t *dir,
+  uint32_t *val);
+int cbar_gpio_set(const struct cbar_model *m, int twifd,
+  const struct cbarpin *pad, int out, int val);
+
+#endif
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* DAC0-DAC3 on the TS-7680 FPGA. Each DAC is a 12-bit value in two
+ * registers starting at 0x2E, the high nibble first. The registers read back
+ * what was last written, so the shadow cache is loaded from them once and
+ * afterwards holds the last written value of every DAC. Setting a DAC only
+ * dirties the bytes that change, and dac_flush() sends all DACs' changes in
+ * as few bursts as possible.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "dac.h"
+#include "fpga.h"
+
+#define DAC_REG			0x2E
+
+/* Rewriting a DAC register with its current value does not disturb the
+ * output, so a dirty byte on either side of a clean DAC is worth sending in
+ * the same burst.
+ */
+#define DAC_GAP			3
+
+/* Loads all of the DAC registers in one read. Optional, dac_get() loads
+ * whatever it is missing, but this must not be called with unflushed
+ * dac_set() values pending as they would be discarded.
+ */
+int dac_init(int twifd)
+{
+	return fpga_cache_load(twifd, DAC_REG, DAC_COUNT * 2);
+}
+
+int dac_get(int twifd, int dac)
+{
+	int hi = fpga_cache_peek(twifd, DAC_REG + (dac * 2));
+	int lo = fpga_cache_peek(twifd, DAC_REG + (dac * 2) + 1);
+
+	if (hi < 0 || lo < 0)
+		return -1;
+
+	return ((hi & 0xf) << 8) | lo;
+}
+
+void dac_set(int dac, int value)
+{
+	if (dac < 0 || dac >= DAC_COUNT)
+		return;
+	if (value < 0)
+		value = 0;
+	if (value > DAC_MAX)
+		value = DAC_MAX;
+
+	fpga_cache_poke(DAC_REG + (dac * 2), (value >> 8) & 0xf);
+	fpga_cache_poke(DAC_REG + (dac * 2) + 1, value & 0xff);
+}
+
+int dac_flush(int twifd)
+{
+	return fpga_cache_flush_range(twifd, DAC_REG, DAC_COUNT * 2, DAC_GAP);
+}
+
+/* Moves each DAC with a target >= 0 to it at slew counts per second,
+ * updating rate_hz times per second. Every step is computed from the start
+ * value and the step's deadline rather than accumulated, so the ramp lands
+ * on time regardless of how long the writes take, and all DACs arrive
+ * together if their distances are equal.
+ */
+int dac_ramp(int twifd, const int *target, int slew, int rate_hz)
+{
+	int start[DAC_COUNT], i, moving;
+	struct timespec t0, next;
+	uint64_t step, period_ns = 1000000000ULL / rate_hz;
+
+	for (i = 0; i < DAC_COUNT; i++) {
+		start[i] = dac_get(twifd, i);
+		if (start[i] < 0)
+			return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (step = 1; ; step++) {
+		uint64_t ns = step * period_ns;
+		long long dist = ((long long)slew * ns) / 1000000000LL;
+
+		moving = 0;
+		for (i = 0; i < DAC_COUNT; i++) {
+			int v;
+
+			if (target[i] < 0)
+				continue;
+			if (target[i] > start[i]) {
+				v = start[i] + dist;
+				if (v >= target[i])
+					v = target[i];
+			} else {
+				v = start[i] - dist;
+				if (v <= target[i])
+					v = target[i];
+			}
+			if (v != target[i])
+				moving = 1;
+			dac_set(i, v);
+		}
+
+		next.tv_sec = t0.tv_sec + (ns / 1000000000ULL);
+		next.tv_nsec = t0.tv_nsec + (ns % 1000000000ULL);
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+		  NULL) == EINTR);
+
+		if (dac_flush(twifd))
+			return -1;
+		if (!moving)
+			break;
+	}
+
+	return 0;
+}
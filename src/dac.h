@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __DAC_H_
+#define __DAC_H_
+
+#define DAC_COUNT		4
+#define DAC_MAX			0xfff
+
+int dac_init(int twifd);
+int dac_get(int twifd, int dac);
+void dac_set(int dac, int value);
+int dac_flush(int twifd);
+int dac_ramp(int twifd, const int *target, int slew, int rate_hz);
+
+#endif
@@ -8,15 +8,39 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
+#include "buslock.h"
+#include "bustrace.h"
 #include "i2c-dev.h"
+#include "fpga.h"
+#include "tshwctld.h"
 
-int fpga_init(char *path, char adr)
-{
-	static int fd = -1;
+/* Every register access goes through one of these. The int handle passed
+ * around as twifd is whatever the backend's open returned.
+ */
+struct fpga_backend {
+	const char *name;
+	int (*open)(const char *arg);
+	int (*read)(int fd, uint16_t addr, uint8_t *buf, int len);
+	int (*write)(int fd, uint16_t addr, const uint8_t *buf, int len);
+	int (*model)(int fd);
+	void (*close)(int fd);
+};
 
-	if(fd != -1)
-		return fd;
+static uint8_t fpga_adr = 0x28;
+
+/*
+ * i2c-dev backend, the real FPGA at fpga_adr on /dev/i2c-0
+ */
+static int i2c_open(const char *path)
+{
+	int fd;
 
 	if(path == NULL) {
 		// Will always be I2C0 on the 7680
@@ -25,11 +49,10 @@ int fpga_init(char *path, char adr)
 		fd = open(path, O_RDWR);
 	}
 
-	if(!adr) adr = 0x28;
-
 	if(fd != -1) {
-		if (ioctl(fd, I2C_SLAVE_FORCE, 0x28) < 0) {
+		if (ioctl(fd, I2C_SLAVE_FORCE, fpga_adr) < 0) {
 			perror("FPGA did not ACK 0x28\n");
+			close(fd);
 			return -1;
 		}
 	}
@@ -37,26 +60,604 @@ int fpga_init(char *path, char adr)
 	return fd;
 }
 
-void fpoke8(int twifd, uint16_t addr, uint8_t value)
+/* Writes len bytes starting at addr as a single I2C message: the 16-bit
+ * address followed by all of the data, which the FPGA stores to consecutive
+ * registers. Multi-byte values written this way land together.
+ */
+static int i2c_write(int twifd, uint16_t addr, const uint8_t *buf, int len)
 {
-	uint8_t data[3];
+	uint8_t data[2 + 256];
+
+	if (len > 256) {
+		fprintf(stderr, "I2C Write too long (%d bytes)\n", len);
+		return -1;
+	}
+
 	data[0] = ((addr >> 8) & 0xff);
 	data[1] = (addr & 0xff);
-	data[2] = value;
-	if (write(twifd, data, 3) != 3) {
+	memcpy(&data[2], buf, len);
+	buslock_acquire();
+	if (write(twifd, data, len + 2) != len + 2) {
+		buslock_release();
 		perror("I2C Write Failed");
+		return -1;
+	}
+	buslock_release();
+
+	return 0;
+}
+
+/* Reads len bytes starting at addr. The address write and the data read are
+ * issued as a single I2C_RDWR transfer with a repeated start, so no other
+ * bus master can slip in between them, and the FPGA auto-increments the
+ * register address for each byte read.
+ */
+static int i2c_read(int twifd, uint16_t addr, uint8_t *buf, int len)
+{
+	uint8_t adrbuf[2];
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data packets;
+
+	if (len > FPGA_MAX_READ) {
+		fprintf(stderr, "I2C Read too long (%d bytes)\n", len);
+		return -1;
+	}
+
+	adrbuf[0] = ((addr >> 8) & 0xff);
+	adrbuf[1] = (addr & 0xff);
+
+	msgs[0].addr = fpga_adr;
+	msgs[0].flags = 0;
+	msgs[0].len = 2;
+	msgs[0].buf = (char *)adrbuf;
+
+	msgs[1].addr = fpga_adr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = len;
+	msgs[1].buf = (char *)buf;
+
+	packets.msgs = msgs;
+	packets.nmsgs = 2;
+
+	buslock_acquire();
+	if (ioctl(twifd, I2C_RDWR, &packets) < 0) {
+		buslock_release();
+		perror("I2C Read Failed");
+		return -1;
+	}
+	buslock_release();
+
+	return 0;
+}
+
+static void fd_close(int fd)
+{
+	close(fd);
+}
+
+/*
+ * tshwctld backend, forwards every access to the daemon
+ */
+
+/* The socket path defaults to TSHWCTLD_SOCKET and can be overridden with the
+ * TSHWCTLD_SOCKET environment variable. Fails quietly if no daemon is
+ * listening so the caller can fall back to another backend.
+ */
+static int remote_open(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (path == NULL) path = getenv("TSHWCTLD_SOCKET");
+	if (path == NULL) path = TSHWCTLD_SOCKET;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int remote_request(int fd, struct tshwctld_req *req,
+  struct tshwctld_resp *resp)
+{
+	int reqlen = TSHWCTLD_REQ_HDR;
+	ssize_t r;
+
+	if (req->cmd != TSHWCTLD_READ) reqlen += req->len;
+
+	if (send(fd, req, reqlen, 0) != reqlen) {
+		perror("tshwctld send");
+		return -1;
+	}
+
+	r = recv(fd, resp, sizeof(*resp), 0);
+	if (r < TSHWCTLD_RESP_HDR) {
+		fprintf(stderr, "tshwctld closed connection\n");
+		return -1;
+	}
+
+	if (resp->status) {
+		errno = resp->status;
+		perror("tshwctld request failed");
+		return -1;
 	}
+
+	return 0;
+}
+
+static int remote_write(int fd, uint16_t addr, const uint8_t *buf, int len)
+{
+	struct tshwctld_req req;
+	struct tshwctld_resp resp;
+
+	while (len > 0) {
+		req.cmd = TSHWCTLD_WRITE;
+		req.len = len > TSHWCTLD_MAX_DATA ? TSHWCTLD_MAX_DATA : len;
+		req.addr = addr;
+		memcpy(req.data, buf, req.len);
+		if (remote_request(fd, &req, &resp))
+			return -1;
+		addr += req.len;
+		buf += req.len;
+		len -= req.len;
+	}
+
+	return 0;
+}
+
+static int remote_read(int fd, uint16_t addr, uint8_t *buf, int len)
+{
+	struct tshwctld_req req;
+	struct tshwctld_resp resp;
+
+	while (len > 0) {
+		req.cmd = TSHWCTLD_READ;
+		req.len = len > TSHWCTLD_MAX_DATA ? TSHWCTLD_MAX_DATA : len;
+		req.addr = addr;
+		if (remote_request(fd, &req, &resp))
+			return -1;
+		if (resp.len != req.len) {
+			fprintf(stderr, "tshwctld short read\n");
+			return -1;
+		}
+		memcpy(buf, resp.data, req.len);
+		addr += req.len;
+		buf += req.len;
+		len -= req.len;
+	}
+
+	return 0;
+}
+
+static int remote_model(int fd)
+{
+	struct tshwctld_req req;
+	struct tshwctld_resp resp;
+	uint32_t model;
+
+	req.cmd = TSHWCTLD_INFO;
+	req.len = 0;
+	req.addr = 0;
+	if (remote_request(fd, &req, &resp) || resp.len != sizeof(model))
+		return 0;
+
+	memcpy(&model, resp.data, sizeof(model));
+	return model;
+}
+
+/*
+ * Simulated FPGA backends. "sim" is a register file in memory, "file" keeps
+ * the register file in a regular file so it persists between invocations.
+ * Both charge every transaction the time it would take on the real bus:
+ * FPGA_SIM_BUS_HZ (default 100000, 0 for no delay) sets the I2C clock and
+ * FPGA_SIM_OVERHEAD_US (default 20) a fixed per-transaction driver cost.
+ * FPGA_SIM_MODEL sets the model reported, default 0x7680.
+ */
+static uint8_t sim_regs[0x10000];
+static long sim_bus_hz = -1, sim_overhead_us;
+
+static void sim_config(void)
+{
+	char *e;
+
+	if (sim_bus_hz != -1)
+		return;
+
+	e = getenv("FPGA_SIM_BUS_HZ");
+	sim_bus_hz = e ? strtol(e, NULL, 0) : 100000;
+	e = getenv("FPGA_SIM_OVERHEAD_US");
+	sim_overhead_us = e ? strtol(e, NULL, 0) : 20;
+}
+
+/* Each byte on the wire is 9 clocks (8 data plus ACK). A write is the slave
+ * address, the 16-bit register address and the data; a read adds a repeated
+ * start and the slave address again. Start and stop are counted as a clock
+ * each.
+ */
+static void sim_delay(int len, int is_read)
+{
+	struct timespec start, now;
+	long long ns, bits;
+
+	if (sim_bus_hz <= 0)
+		return;
+
+	bits = 2 + (9 * (3 + len));
+	if (is_read) bits += 1 + 9;
+	ns = (bits * 1000000000LL) / sim_bus_hz;
+	ns += sim_overhead_us * 1000LL;
+
+	/* Spin rather than sleep, scheduler slack would swamp the model */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (((now.tv_sec - start.tv_sec) * 1000000000LL) +
+	  (now.tv_nsec - start.tv_nsec) < ns);
+}
+
+static int sim_open(const char *arg)
+{
+	sim_config();
+	return 0;
+}
+
+static int sim_write(int fd, uint16_t addr, const uint8_t *buf, int len)
+{
+	if (addr + len > sizeof(sim_regs))
+		return -1;
+	sim_delay(len, 0);
+	memcpy(&sim_regs[addr], buf, len);
+
+	return 0;
+}
+
+static int sim_read(int fd, uint16_t addr, uint8_t *buf, int len)
+{
+	if (addr + len > sizeof(sim_regs))
+		return -1;
+	sim_delay(len, 1);
+	memcpy(buf, &sim_regs[addr], len);
+
+	return 0;
+}
+
+static int sim_model(int fd)
+{
+	char *e = getenv("FPGA_SIM_MODEL");
+
+	return e ? strtol(e, NULL, 16) : 0x7680;
+}
+
+static void sim_close(int fd)
+{
+}
+
+static int file_open(const char *path)
+{
+	int fd;
+
+	if (path == NULL) {
+		fprintf(stderr, "file backend needs a path, file:<path>\n");
+		return -1;
+	}
+
+	sim_config();
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+		perror(path);
+
+	return fd;
+}
+
+static int file_write(int fd, uint16_t addr, const uint8_t *buf, int len)
+{
+	sim_delay(len, 0);
+	if (pwrite(fd, buf, len, addr) != len) {
+		perror("FPGA file write");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Registers past the end of the file read as 0 */
+static int file_read(int fd, uint16_t addr, uint8_t *buf, int len)
+{
+	ssize_t r;
+
+	sim_delay(len, 1);
+	r = pread(fd, buf, len, addr);
+	if (r < 0) {
+		perror("FPGA file read");
+		return -1;
+	}
+	memset(buf + r, 0, len - r);
+
+	return 0;
+}
+
+static const struct fpga_backend backends[] = {
+	{ "i2c", i2c_open, i2c_read, i2c_write, NULL, fd_close },
+	{ "tshwctld", remote_open, remote_read, remote_write, remote_model,
+	  fd_close },
+	{ "sim", sim_open, sim_read, sim_write, sim_model, sim_close },
+	{ "file", file_open, file_read, file_write, sim_model, fd_close },
+	{ NULL },
+};
+
+static const struct fpga_backend *backend = &backends[0];
+
+/* Opens a backend from a spec of the form "<name>[:<arg>]", e.g. "i2c",
+ * "i2c:/dev/i2c-1", "tshwctld:/tmp/sock", "sim" or "file:/tmp/regs".
+ */
+int fpga_open(const char *spec)
+{
+	const struct fpga_backend *b;
+	const char *arg = strchr(spec, ':');
+	int namelen = arg ? arg - spec : strlen(spec);
+	int fd;
+
+	for (b = backends; b->name != NULL; b++) {
+		if (strlen(b->name) == namelen &&
+		  strncmp(b->name, spec, namelen) == 0)
+			break;
+	}
+	if (b->name == NULL) {
+		fprintf(stderr, "Unknown FPGA backend %s\n", spec);
+		return -1;
+	}
+
+	fd = b->open(arg ? arg + 1 : NULL);
+	if (fd != -1)
+		backend = b;
+
+	return fd;
+}
+
+int fpga_init(char *path, char adr)
+{
+	static int fd = -1;
+
+	if(fd != -1)
+		return fd;
+
+	if(!adr) adr = 0x28;
+	fpga_adr = adr;
+
+	fd = i2c_open(path);
+	if (fd != -1)
+		backend = &backends[0];
+
+	return fd;
+}
+
+/* Connects to a running tshwctld instead of opening the bus directly.
+ * Returns -1 quietly if no daemon is listening so the caller can fall back
+ * to fpga_init().
+ */
+int fpga_connect(const char *path)
+{
+	int fd = remote_open(path);
+
+	if (fd != -1)
+		backend = &backends[1];
+
+	return fd;
+}
+
+/* Returns 1 if accesses go through tshwctld */
+int fpga_is_remote(void)
+{
+	return backend == &backends[1];
+}
+
+/* Sends a tshwctld crossbar request, TSHWCTLD_CBAR_GET or _SET, with arg as
+ * its data. The reply, if any, is copied to reply as a string. Returns 0,
+ * or -1 on failure.
+ */
+int fpga_remote_cbar(int twifd, int cmd, const char *arg, char *reply,
+  int len)
+{
+	struct tshwctld_req req;
+	struct tshwctld_resp resp;
+	size_t n = strlen(arg);
+
+	if (!fpga_is_remote() || n > TSHWCTLD_MAX_DATA)
+		return -1;
+	req.cmd = cmd;
+	req.len = n;
+	req.addr = 0;
+	memcpy(req.data, arg, n);
+	if (remote_request(twifd, &req, &resp))
+		return -1;
+	if (reply && len > 0)
+		snprintf(reply, len, "%.*s", resp.len, (char *)resp.data);
+
+	return 0;
+}
+
+/* Returns the board model if the backend knows it, 0 otherwise */
+int fpga_model(int twifd)
+{
+	return backend->model ? backend->model(twifd) : 0;
+}
+
+void fpga_close(int twifd)
+{
+	backend->close(twifd);
+}
+
+void fpoke8(int twifd, uint16_t addr, uint8_t value)
+{
+	fpoke_block(twifd, addr, &value, 1);
 }
 
 uint8_t fpeek8(int twifd, uint16_t addr)
 {
-	uint8_t data[2];
-	data[0] = ((addr >> 8) & 0xff);
-	data[1] = (addr & 0xff);
-	if (write(twifd, data, 2) != 2) {
-		perror("I2C Address set Failed");
+	uint8_t data = 0;
+
+	fpeek_block(twifd, addr, &data, 1);
+
+	return data;
+}
+
+int fpoke_block(int twifd, uint16_t addr, const uint8_t *buf, int len)
+{
+	uint64_t start = BUSTRACE_BEGIN();
+	int ret = backend->write(twifd, addr, buf, len);
+
+	BUSTRACE_END(start, fpga_adr, addr, BUSTRACE_WRITE, len, ret);
+	return ret;
+}
+
+int fpeek_block(int twifd, uint16_t addr, uint8_t *buf, int len)
+{
+	uint64_t start = BUSTRACE_BEGIN();
+	int ret = backend->read(twifd, addr, buf, len);
+
+	BUSTRACE_END(start, fpga_adr, addr, BUSTRACE_READ, len, ret);
+	return ret;
+}
+
+/* Shadow cache of the 0x00-0x7F register file. Reads are satisfied from the
+ * shadow once a register has been loaded, writes only update the shadow and
+ * mark the register dirty, and fpga_cache_flush() commits all dirty
+ * registers with one burst per contiguous run. Writing a register with the
+ * value already in the shadow does not dirty it.
+ */
+static uint8_t shadow[FPGA_CACHE_SIZE];
+static uint8_t shadow_valid[FPGA_CACHE_SIZE];
+static uint8_t shadow_dirty[FPGA_CACHE_SIZE];
+
+/* Reads len registers from addr into the shadow. Registers with unflushed
+ * writes keep the written value rather than what the FPGA holds.
+ */
+int fpga_cache_load(int twifd, uint16_t addr, int len)
+{
+	uint8_t buf[FPGA_CACHE_SIZE];
+	int i;
+
+	if (addr + len > FPGA_CACHE_SIZE) {
+		fprintf(stderr, "Cache load 0x%X+%d out of range\n", addr, len);
+		return -1;
+	}
+
+	if (fpeek_block(twifd, addr, buf, len))
+		return -1;
+
+	for (i = addr; i < addr + len; i++) {
+		if (shadow_dirty[i])
+			continue;
+		shadow[i] = buf[i - addr];
+		shadow_valid[i] = 1;
 	}
-	read(twifd, data, 1);
 
-	return data[0];
+	return 0;
+}
+
+/* Forgets len registers starting at addr, discarding any unflushed writes */
+void fpga_cache_invalidate(uint16_t addr, int len)
+{
+	if (addr >= FPGA_CACHE_SIZE)
+		return;
+	if (addr + len > FPGA_CACHE_SIZE)
+		len = FPGA_CACHE_SIZE - addr;
+
+	memset(&shadow_valid[addr], 0, len);
+	memset(&shadow_dirty[addr], 0, len);
+}
+
+/* Returns the register value, or -1 if it had to be read and that failed */
+int fpga_cache_peek(int twifd, uint16_t addr)
+{
+	uint8_t data;
+
+	if (addr >= FPGA_CACHE_SIZE)
+		return fpeek_block(twifd, addr, &data, 1) ? -1 : data;
+
+	if (!shadow_valid[addr] && fpga_cache_load(twifd, addr, 1))
+		return -1;
+
+	return shadow[addr];
+}
+
+void fpga_cache_poke(uint16_t addr, uint8_t value)
+{
+	if (addr >= FPGA_CACHE_SIZE) {
+		fprintf(stderr, "Cache poke 0x%X out of range\n", addr);
+		return;
+	}
+
+	if (shadow_valid[addr] && shadow[addr] == value)
+		return;
+
+	shadow[addr] = value;
+	shadow_valid[addr] = 1;
+	shadow_dirty[addr] = 1;
+}
+
+/* Replaces the bits set in mask with those of value, leaving the rest as they
+ * are in the shadow. The register is read from the FPGA only on a miss, a
+ * failed read returns -1 without staging anything.
+ */
+int fpga_cache_rmw(int twifd, uint16_t addr, uint8_t mask, uint8_t value)
+{
+	int old = fpga_cache_peek(twifd, addr);
+
+	if (old < 0)
+		return -1;
+	fpga_cache_poke(addr, (old & ~mask) | (value & mask));
+
+	return 0;
+}
+
+/* Flushes the dirty registers in addr..addr+len-1. Dirty runs separated by
+ * no more than gap clean, valid registers are sent as one burst, rewriting
+ * the registers in between with the value they already hold. On I2C each
+ * burst costs the slave address and two address bytes, so a gap of up to 3
+ * is never more traffic than a second transaction. Only use a gap on
+ * registers where a rewrite of the same value has no side effect.
+ */
+int fpga_cache_flush_range(int twifd, uint16_t addr, int len, int gap)
+{
+	int i, start = -1, last = -1, ret = 0;
+	int end = addr + len;
+
+	if (end > FPGA_CACHE_SIZE)
+		end = FPGA_CACHE_SIZE;
+
+	for (i = addr; i <= end; i++) {
+		if (i < end && shadow_dirty[i]) {
+			if (start == -1) start = i;
+			last = i;
+			continue;
+		}
+		if (start == -1)
+			continue;
+		if (i < end && shadow_valid[i] && i - last <= gap)
+			continue;
+		if (fpoke_block(twifd, start, &shadow[start],
+		  last + 1 - start) == 0) {
+			memset(&shadow_dirty[start], 0, last + 1 - start);
+		} else {
+			ret = -1;
+		}
+		start = -1;
+	}
+
+	return ret;
+}
+
+int fpga_cache_flush(int twifd)
+{
+	return fpga_cache_flush_range(twifd, 0, FPGA_CACHE_SIZE, 0);
 }
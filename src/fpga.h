@@ -4,14 +4,29 @@
 #ifndef __FPGA_H_
 #define __FPGA_H_
 
-struct cbarpin
-{
-	int addr;
-	char *name;
-};
+#define FPGA_CACHE_SIZE		0x80
+/* Longest fpeek_block(), an I2C_RDWR message length is 16 bits */
+#define FPGA_MAX_READ		0xffff
 
+int fpga_open(const char *spec);
 int fpga_init(char *path, char adr);
+int fpga_connect(const char *path);
+int fpga_model(int twifd);
+int fpga_is_remote(void);
+int fpga_remote_cbar(int twifd, int cmd, const char *arg, char *reply,
+  int len);
+void fpga_close(int twifd);
 void fpoke8(int twifd, uint16_t addr, uint8_t value);
 uint8_t fpeek8(int twifd, uint16_t addr);
+int fpoke_block(int twifd, uint16_t addr, const uint8_t *buf, int len);
+int fpeek_block(int twifd, uint16_t addr, uint8_t *buf, int len);
+
+int fpga_cache_load(int twifd, uint16_t addr, int len);
+void fpga_cache_invalidate(uint16_t addr, int len);
+int fpga_cache_peek(int twifd, uint16_t addr);
+void fpga_cache_poke(uint16_t addr, uint8_t value);
+int fpga_cache_rmw(int twifd, uint16_t addr, uint8_t mask, uint8_t value);
+int fpga_cache_flush_range(int twifd, uint16_t addr, int len, int gap);
+int fpga_cache_flush(int twifd);
 
 #endif
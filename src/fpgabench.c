@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Measures the cost of FPGA register access through the fpga.c API against
+ * any backend. Each test runs a number of iterations and reports throughput
+ * along with the latency distribution of a single operation.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crossbar.h"
+#include "fpga.h"
+
+#define HIST_BUCKETS	24
+
+static int twifd;
+static const struct cbar_model *cbar;
+static int blocklen = 16;
+
+const char copyright[] = "Copyright (c) embeddedTS - " __DATE__ " - "
+  GITCOMMIT;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Every op returns 0, or -1 if the backend failed. The single register
+ * ops use the block calls as fpeek8() and fpoke8() cannot report errors.
+ */
+static int op_peek8(int i)
+{
+	uint8_t val;
+
+	return fpeek_block(twifd, i & 0x7f, &val, 1);
+}
+
+static int op_poke8(int i)
+{
+	uint8_t val = i;
+
+	return fpoke_block(twifd, 0x2E + (i & 0x7), &val, 1);
+}
+
+static int op_peek_block(int i)
+{
+	uint8_t buf[256];
+
+	return fpeek_block(twifd, 0, buf, blocklen);
+}
+
+static int op_poke_block(int i)
+{
+	uint8_t buf[256];
+
+	memset(buf, i, blocklen);
+	return fpoke_block(twifd, 0x2E, buf, blocklen);
+}
+
+/* Uncached read-modify-write of one pad, as --set did per register */
+static int op_rmw(int i)
+{
+	uint8_t val;
+
+	if (fpeek_block(twifd, cbar->outputs[0].addr, &val, 1))
+		return -1;
+	val = (val & 0x3) | ((i & 0x3f) << 2);
+	return fpoke_block(twifd, cbar->outputs[0].addr, &val, 1);
+}
+
+static int op_cbar_dump(int i)
+{
+	return fpga_cache_load(twifd, cbar->lo, (cbar->hi - cbar->lo) + 1);
+}
+
+/* Reroute every pad through the shadow cache and commit it */
+static int op_cbar_apply(int i)
+{
+	int j;
+
+	if (fpga_cache_load(twifd, cbar->lo, (cbar->hi - cbar->lo) + 1))
+		return -1;
+	for (j = 0; j < cbar->noutputs; j++) {
+		if (fpga_cache_rmw(twifd, cbar->outputs[j].addr, 0xfc,
+		  ((i + j) & 0x3f) << 2))
+			return -1;
+	}
+	return fpga_cache_flush(twifd);
+}
+
+static const struct bench {
+	const char *name;
+	int (*op)(int i);
+	int writes;
+} benches[] = {
+	{ "peek8", op_peek8, 0 },
+	{ "poke8", op_poke8, 1 },
+	{ "peek_block", op_peek_block, 0 },
+	{ "poke_block", op_poke_block, 1 },
+	{ "rmw", op_rmw, 1 },
+	{ "cbar_dump", op_cbar_dump, 0 },
+	{ "cbar_apply", op_cbar_apply, 1 },
+	{ NULL, NULL, 0 },
+};
+
+/* The span of registers the write tests touch: the TXEN counters and
+ * everything a poke_block reaches from 0x2E, and the crossbar pads.
+ */
+static int save_lo, save_len;
+static uint8_t saved[0x80];
+
+static int save_regs(void)
+{
+	int hi = 0x2E + (blocklen > 8 ? blocklen : 8) - 1;
+
+	save_lo = cbar->lo < 0x2E ? cbar->lo : 0x2E;
+	if (cbar->hi > hi)
+		hi = cbar->hi;
+	save_len = (hi - save_lo) + 1;
+
+	return fpeek_block(twifd, save_lo, saved, save_len);
+}
+
+static int restore_regs(void)
+{
+	fpga_cache_invalidate(save_lo, save_len);
+	return fpoke_block(twifd, save_lo, saved, save_len);
+}
+
+/* Power of two buckets in microseconds, bucket 0 is everything under 1us */
+static void print_histogram(uint64_t *lat, int n)
+{
+	int hist[HIST_BUCKETS] = { 0 };
+	int i, b, max = 0;
+
+	for (i = 0; i < n; i++) {
+		uint64_t us = lat[i] / 1000;
+		for (b = 0; us && b < HIST_BUCKETS - 1; b++)
+			us >>= 1;
+		hist[b]++;
+		if (hist[b] > max) max = hist[b];
+	}
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		printf("  %8luus - %8luus %8d ",
+		  b ? 1UL << (b - 1) : 0UL, 1UL << b, hist[b]);
+		for (i = 0; i < (hist[b] * 40) / max; i++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+/* Times iters runs of b. Stops at the first failed operation, which
+ * would otherwise be timed as a fast success, and returns -1.
+ */
+static int run_bench(const struct bench *b, int iters, int histogram)
+{
+	uint64_t *lat, start, total;
+	int i;
+
+	lat = malloc(sizeof(*lat) * iters);
+	if (lat == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	total = now_ns();
+	for (i = 0; i < iters; i++) {
+		start = now_ns();
+		if (b->op(i)) {
+			printf("%-12s failed after %d ops\n", b->name, i);
+			free(lat);
+			return -1;
+		}
+		lat[i] = now_ns() - start;
+	}
+	total = now_ns() - total;
+
+	qsort(lat, iters, sizeof(*lat), cmp_u64);
+	printf("%-12s %8d ops %10.1f ops/s  p50 %7.1fus  p99 %7.1fus  "
+	  "max %7.1fus\n", b->name, iters,
+	  iters / (total / 1e9),
+	  lat[iters / 2] / 1e3,
+	  lat[(iters * 99) / 100] / 1e3,
+	  lat[iters - 1] / 1e3);
+	if (histogram)
+		print_histogram(lat, iters);
+
+	free(lat);
+
+	return 0;
+}
+
+static void usage(char **argv) {
+	int i;
+
+	fprintf(stderr,
+	  "%s\n\n"
+	  "Usage: %s [OPTIONS] [TEST] ...\n"
+	  "embeddedTS FPGA access benchmark\n"
+	  "\n"
+	  "  -k, --backend <spec>   FPGA access backend, default sim\n"
+	  "                           see tshwctl --help\n"
+	  "  -n, --iterations <n>   Iterations per test, default 1000\n"
+	  "  -l, --length <n>       Length of block transfers, default 16\n"
+	  "  -H, --histogram        Print latency histograms\n"
+	  "  -D, --destructive      Run the write tests on a backend other\n"
+	  "                           than sim or file\n"
+	  "  -h, --help             This message\n"
+	  "\n"
+	  "Runs every test unless some are named. The write tests scribble on\n"
+	  "the TXEN counter, DAC and crossbar registers, which are restored\n"
+	  "afterwards. On real hardware the pads are rerouted at random while\n"
+	  "they run, so they are skipped unless --destructive is given. Tests:\n",
+	  copyright, argv[0]
+	);
+	for (i = 0; benches[i].name != NULL; i++)
+		fprintf(stderr, "  %s\n", benches[i].name);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, j, ret = 0;
+	int iters = 1000, histogram = 0, destructive = 0, model;
+	char *backend = "sim";
+
+	static struct option long_options[] = {
+		{ "backend", 1, 0, 'k' },
+		{ "iterations", 1, 0, 'n' },
+		{ "length", 1, 0, 'l' },
+		{ "histogram", 0, 0, 'H' },
+		{ "destructive", 0, 0, 'D' },
+		{ "help", 0, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while((c = getopt_long(argc, argv, "k:n:l:HDh", long_options, NULL))
+	  != -1) {
+		switch(c) {
+		case 'k':
+			backend = strdup(optarg);
+			break;
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'l':
+			blocklen = atoi(optarg);
+			break;
+		case 'H':
+			histogram = 1;
+			break;
+		case 'D':
+			destructive = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (iters < 1 || blocklen < 1 || blocklen > 0x52) {
+		fprintf(stderr, "Invalid iterations or length\n");
+		return 1;
+	}
+
+	twifd = fpga_open(backend);
+	if (twifd == -1)
+		return 1;
+	if (strcmp(backend, "sim") == 0 || strncmp(backend, "file:", 5) == 0)
+		destructive = 1;
+
+	model = fpga_model(twifd);
+	if (!model)
+		model = 0x7680;
+	cbar = cbar_get_model(model);
+	if (cbar == NULL) {
+		fprintf(stderr, "Unsupported model TS-%X\n", model);
+		return 1;
+	}
+
+	printf("backend %s, model TS-%X, %d byte blocks\n", backend,
+	  model, blocklen);
+
+	for (i = 0; benches[i].name != NULL; i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (strcmp(argv[j], benches[i].name) == 0)
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+		if (!benches[i].writes) {
+			if (run_bench(&benches[i], iters, histogram))
+				ret = 1;
+			continue;
+		}
+		if (!destructive) {
+			printf("%-12s skipped, needs --destructive\n",
+			  benches[i].name);
+			continue;
+		}
+		if (save_regs()) {
+			fprintf(stderr, "Unable to save registers\n");
+			return 1;
+		}
+		if (run_bench(&benches[i], iters, histogram))
+			ret = 1;
+		if (restore_regs()) {
+			fprintf(stderr, "Unable to restore registers\n");
+			return 1;
+		}
+	}
+
+	fpga_close(twifd);
+
+	return ret;
+}
@@ -0,0 +1,346 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Access to ADCs through the kernel's IIO subsystem rather than their
+ * registers, so the utilities can run alongside the mxs-lradc driver. The
+ * sysfs root is /sys/bus/iio/devices and the buffer devices are in /dev,
+ * IIO_ROOT and IIO_DEV override them to run against a stand-in directory
+ * tree, where the buffer device can be a plain file of scans.
+ */
+
+#include <dirent.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iio.h"
+
+const char *iio_root(void)
+{
+	const char *root = getenv("IIO_ROOT");
+
+	return (root && *root) ? root : "/sys/bus/iio/devices";
+}
+
+/* Returns 1 if spec (--backend or ADC_BACKEND) selects IIO, 0 for the
+ * default register access and -1 if it is neither.
+ */
+int iio_backend(const char *spec)
+{
+	if (spec == NULL || *spec == '\0' || strcmp(spec, "mmio") == 0)
+		return 0;
+	if (strcmp(spec, "iio") == 0)
+		return 1;
+	fprintf(stderr, "Unknown ADC backend %s\n", spec);
+
+	return -1;
+}
+
+static const char *iio_devdir(void)
+{
+	const char *dev = getenv("IIO_DEV");
+
+	return (dev && *dev) ? dev : "/dev";
+}
+
+static int read_str(const char *dir, const char *attr, char *buf, int len)
+{
+	char path[512];
+	FILE *f;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, len, f)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+	fclose(f);
+
+	return ret;
+}
+
+int iio_write(const char *dir, const char *attr, const char *val)
+{
+	char path[512];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	ret = fprintf(f, "%s\n", val) < 0;
+	if (fclose(f) || ret) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Finds the first IIO device whose name starts with prefix. The mxs-lradc
+ * driver has been "mxs-lradc" and, since the MFD split, "mxs-lradc-adc".
+ */
+int iio_find(struct iio_dev *d, const char *prefix)
+{
+	DIR *dir;
+	struct dirent *de;
+	char name[64];
+	int found = 0;
+
+	dir = opendir(iio_root());
+	if (dir == NULL)
+		return -1;
+	while (!found && (de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "iio:device", 10))
+			continue;
+		if (snprintf(d->path, sizeof(d->path), "%s/%s", iio_root(),
+		  de->d_name) >= (int)sizeof(d->path))
+			continue;
+		if (read_str(d->path, "name", name, sizeof(name)) == 0 &&
+		  strncmp(name, prefix, strlen(prefix)) == 0)
+			found = snprintf(d->node, sizeof(d->node), "%s/%s",
+			  iio_devdir(), de->d_name) < (int)sizeof(d->node);
+	}
+	closedir(dir);
+
+	return found ? 0 : -1;
+}
+
+int iio_read_long(const struct iio_dev *d, const char *attr, long *val)
+{
+	char buf[64], *end;
+
+	if (read_str(d->path, attr, buf, sizeof(buf)))
+		return -1;
+	*val = strtol(buf, &end, 0);
+
+	return end == buf ? -1 : 0;
+}
+
+/* Parses a scan_elements type, e.g. "le:u12/16>>0" */
+static int parse_type(const char *type, struct iio_chan *c)
+{
+	char endian, sign;
+	int storage;
+
+	if (sscanf(type, "%ce:%c%d/%d>>%d", &endian, &sign, &c->bits,
+	  &storage, &c->shift) != 5 || storage % 8 || storage > 64)
+		return -1;
+	c->is_be = endian == 'b';
+	c->is_signed = sign == 's';
+	c->bytes = storage / 8;
+
+	return 0;
+}
+
+static int elem_read(struct iio_dev *d, const char *elem, const char *attr,
+  char *buf, int len)
+{
+	char name[128];
+
+	snprintf(name, sizeof(name), "scan_elements/%s_%s", elem, attr);
+	return read_str(d->path, name, buf, len);
+}
+
+static int elem_write(struct iio_dev *d, const char *elem, const char *attr,
+  const char *val)
+{
+	char name[128];
+
+	snprintf(name, sizeof(name), "scan_elements/%s_%s", elem, attr);
+	return iio_write(d->path, name, val);
+}
+
+/* Disables every scan element, so none left enabled by an earlier user
+ * end up in the scan layout.
+ */
+static int elem_disable_all(struct iio_dev *d)
+{
+	DIR *dir;
+	struct dirent *de;
+	char path[512];
+	size_t len;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/scan_elements", d->path);
+	dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		if (len > 3 && strcmp(de->d_name + len - 3, "_en") == 0 &&
+		  iio_write(path, de->d_name, "0"))
+			ret = -1;
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/* Enables the named scan elements (e.g. "in_voltage0") and the timestamp
+ * if there is one, sets the buffer length and enables the buffer. scan
+ * gets the layout of each scan, with chans[] in the order given. The
+ * timestamp is only used if it can be switched to CLOCK_MONOTONIC, which
+ * every other path uses; kernels before 4.10 only stamp CLOCK_REALTIME.
+ */
+int iio_buffer_start(struct iio_dev *d, const char *const *chans,
+  int nchans, int length, struct iio_scan *scan)
+{
+	struct iio_chan all[IIO_MAX_CHANNELS + 1], *c;
+	char buf[64], path[512];
+	int i, j, n, off, ts = -1;
+
+	if (nchans > IIO_MAX_CHANNELS)
+		return -1;
+	iio_write(d->path, "buffer/enable", "0");
+	if (elem_disable_all(d))
+		return -1;
+
+	for (i = 0; i < nchans; i++) {
+		c = &all[i];
+		if (elem_read(d, chans[i], "index", buf, sizeof(buf)) ||
+		  elem_read(d, chans[i], "type", buf + 16, sizeof(buf) - 16))
+			goto missing;
+		c->index = atoi(buf);
+		if (parse_type(buf + 16, c))
+			goto missing;
+		if (elem_write(d, chans[i], "en", "1"))
+			return -1;
+	}
+	n = nchans;
+	snprintf(path, sizeof(path), "%s/current_timestamp_clock", d->path);
+	if (access(path, W_OK) == 0 &&
+	  iio_write(d->path, "current_timestamp_clock", "monotonic") == 0 &&
+	  elem_read(d, "in_timestamp", "index", buf, sizeof(buf)) == 0 &&
+	  elem_read(d, "in_timestamp", "type", buf + 16,
+	  sizeof(buf) - 16) == 0 &&
+	  parse_type(buf + 16, &all[n]) == 0 &&
+	  elem_write(d, "in_timestamp", "en", "1") == 0) {
+		all[n].index = atoi(buf);
+		ts = n++;
+	}
+
+	/* Elements are laid out in index order, each aligned to its size */
+	off = 0;
+	for (i = 0; i < n; i++)
+		all[i].offset = -2;
+	for (i = 0; i < n; i++) {
+		int lowest = -1;
+
+		for (j = 0; j < n; j++) {
+			if (all[j].offset == -2 && (lowest == -1 ||
+			  all[j].index < all[lowest].index))
+				lowest = j;
+		}
+		c = &all[lowest];
+		off = (off + c->bytes - 1) / c->bytes * c->bytes;
+		c->offset = off;
+		off += c->bytes;
+	}
+
+	scan->nchans = nchans;
+	memcpy(scan->chans, all, nchans * sizeof(all[0]));
+	scan->ts_offset = ts == -1 ? -1 : all[ts].offset;
+	scan->size = off;
+	for (i = 0; i < n; i++) {
+		if (all[i].bytes > 1)
+			scan->size = (scan->size + all[i].bytes - 1) /
+			  all[i].bytes * all[i].bytes;
+	}
+
+	snprintf(buf, sizeof(buf), "%d", length);
+	if (iio_write(d->path, "buffer/length", buf) ||
+	  iio_write(d->path, "buffer/enable", "1"))
+		return -1;
+
+	return 0;
+
+missing:
+	fprintf(stderr, "%s: No scan element %s\n", d->path, chans[i]);
+	return -1;
+}
+
+void iio_buffer_stop(struct iio_dev *d)
+{
+	iio_write(d->path, "buffer/enable", "0");
+}
+
+int64_t iio_scan_value(const struct iio_chan *c, const uint8_t *buf)
+{
+	uint64_t raw = 0;
+	int64_t val;
+	int i;
+
+	for (i = 0; i < c->bytes; i++) {
+		if (c->is_be)
+			raw = (raw << 8) | buf[c->offset + i];
+		else
+			raw |= (uint64_t)buf[c->offset + i] << (8 * i);
+	}
+	raw >>= c->shift;
+	if (c->bits < 64)
+		raw &= (1ULL << c->bits) - 1;
+	val = raw;
+	if (c->is_signed && c->bits < 64 && (raw >> (c->bits - 1)) & 1)
+		val -= 1LL << c->bits;
+
+	return val;
+}
+
+int64_t iio_scan_timestamp(const struct iio_scan *s, const uint8_t *buf)
+{
+	int64_t ts;
+
+	if (s->ts_offset < 0)
+		return -1;
+	memcpy(&ts, buf + s->ts_offset, sizeof(ts));
+
+	return ts;
+}
+
+/* Points the device at the trigger called name, setting the trigger's rate
+ * if it has one.
+ */
+int iio_set_trigger(struct iio_dev *d, const char *name, int rate_hz)
+{
+	DIR *dir;
+	struct dirent *de;
+	char path[300], tname[64], rate[16];
+	int ret = -1;
+
+	dir = opendir(iio_root());
+	if (dir == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "trigger", 7))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", iio_root(), de->d_name);
+		if (read_str(path, "name", tname, sizeof(tname)) ||
+		  strcmp(tname, name))
+			continue;
+		if (rate_hz > 0) {
+			snprintf(rate, sizeof(rate), "%d", rate_hz);
+			if (iio_write(path, "sampling_frequency", rate))
+				break;
+		}
+		ret = iio_write(d->path, "trigger/current_trigger", name);
+		break;
+	}
+	closedir(dir);
+	if (ret)
+		fprintf(stderr, "No IIO trigger %s\n", name);
+
+	return ret;
+}
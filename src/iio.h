@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __IIO_H_
+#define __IIO_H_
+
+#include <stdint.h>
+
+#define IIO_MAX_CHANNELS	16
+
+struct iio_dev {
+	char path[256];			/* Under IIO_ROOT */
+	char node[256];			/* Buffer character device */
+};
+
+struct iio_chan {
+	int index;			/* Position in the scan order */
+	int offset;			/* Byte offset in a scan */
+	int bytes, bits, shift;
+	int is_signed, is_be;
+};
+
+/* Layout of one scan from the buffer character device */
+struct iio_scan {
+	int nchans;
+	struct iio_chan chans[IIO_MAX_CHANNELS];
+	int ts_offset;			/* -1 if there is no timestamp */
+	int size;
+};
+
+int iio_backend(const char *spec);
+const char *iio_root(void);
+int iio_find(struct iio_dev *d, const char *prefix);
+int iio_read_long(const struct iio_dev *d, const char *attr, long *val);
+int iio_write(const char *dir, const char *attr, const char *val);
+int iio_buffer_start(struct iio_dev *d, const char *const *chans,
+  int nchans, int length, struct iio_scan *scan);
+void iio_buffer_stop(struct iio_dev *d);
+int64_t iio_scan_value(const struct iio_chan *c, const uint8_t *buf);
+int64_t iio_scan_timestamp(const struct iio_scan *s, const uint8_t *buf);
+int iio_set_trigger(struct iio_dev *d, const char *name, int rate_hz);
+
+#endif
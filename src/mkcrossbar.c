@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Build-time generator for crossbar-hash.h. For each model's crossbar tables
+ * this searches for an FNV-1a seed that places every name in its own slot,
+ * and emits the slot tables along with the mode to input name index and the
+ * pad register span.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crossbar.h"
+#include "crossbar-ts7680.h"
+#include "crossbar-ts7682.h"
+
+#define SLOTS		128
+
+static int count(const struct cbarpin *t)
+{
+	int n = 0;
+
+	while (t[n].name != 0)
+		n++;
+
+	return n;
+}
+
+/* Duplicate names (the RESERVED inputs) keep only their first entry, the
+ * same one a linear search would find.
+ */
+static int is_dup(const struct cbarpin *t, int i)
+{
+	int j;
+
+	for (j = 0; j < i; j++) {
+		if (strcmp(t[j].name, t[i].name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void gen_slots(const char *prefix, const char *table,
+  const struct cbarpin *t)
+{
+	int8_t slots[SLOTS];
+	uint32_t seed;
+	int i, n = count(t), ok = 0;
+	char upper[64];
+
+	for (seed = 0; seed < 1000000 && !ok; seed++) {
+		memset(slots, -1, sizeof(slots));
+		ok = 1;
+		for (i = 0; i < n && ok; i++) {
+			int h;
+
+			if (is_dup(t, i))
+				continue;
+			h = cbar_hash(seed, t[i].name) & (SLOTS - 1);
+			if (slots[h] != -1)
+				ok = 0;
+			else
+				slots[h] = i;
+		}
+	}
+	if (!ok) {
+		fprintf(stderr, "No perfect hash for %s_%s\n", prefix, table);
+		exit(1);
+	}
+	seed--;
+
+	for (i = 0; prefix[i] && i < sizeof(upper) - 1; i++)
+		upper[i] = toupper(prefix[i]);
+	upper[i] = 0;
+
+	printf("#define %s_%s_SEED\t0x%xu\n\n", upper,
+	  strcmp(table, "outputs") ? "INPUTS" : "OUTPUTS", seed);
+	printf("static const int8_t %s_%s_slots[%d] = {", prefix, table, SLOTS);
+	for (i = 0; i < SLOTS; i++)
+		printf("%s%d,", (i % 16) ? " " : "\n\t", slots[i]);
+	printf("\n};\n\n");
+}
+
+static void gen_model(const char *prefix, const struct cbarpin *outputs,
+  const struct cbarpin *inputs)
+{
+	int i, lo = 0xffff, hi = 0, n = count(inputs);
+	char upper[64];
+
+	for (i = 0; prefix[i] && i < sizeof(upper) - 1; i++)
+		upper[i] = toupper(prefix[i]);
+	upper[i] = 0;
+
+	for (i = 0; outputs[i].name != 0; i++) {
+		if (outputs[i].addr < lo) lo = outputs[i].addr;
+		if (outputs[i].addr > hi) hi = outputs[i].addr;
+	}
+
+	printf("#define %s_NOUTPUTS\t%d\n", upper, count(outputs));
+	printf("#define %s_NINPUTS\t%d\n", upper, n);
+	printf("#define %s_PAD_LO\t0x%x\n", upper, lo);
+	printf("#define %s_PAD_HI\t0x%x\n\n", upper, hi);
+
+	gen_slots(prefix, "outputs", outputs);
+	gen_slots(prefix, "inputs", inputs);
+
+	printf("static const char *const %s_input_by_mode[CBAR_MODES] = {\n",
+	  prefix);
+	for (i = 0; i < n && i < CBAR_MODES; i++)
+		printf("\t\"%s\",\n", inputs[i].name);
+	printf("};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	printf("/* Generated by mkcrossbar, do not edit */\n\n");
+	printf("#ifndef _CROSSBAR_HASH_H_\n#define _CROSSBAR_HASH_H_\n\n");
+	printf("#define CBAR_SLOTS\t%d\n\n", SLOTS);
+	gen_model("ts7680", ts7680_outputs, ts7680_inputs);
+	gen_model("ts7682", ts7682_outputs, ts7682_inputs);
+	printf("#endif\n");
+
+	return 0;
+}
@@ -2,53 +2,382 @@
 /* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <gpiod.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "adcwait.h"
+#include "iio.h"
 
 const char copyright[] = "Copyright (c) embeddedTS - " __DATE__ " - "
   GITCOMMIT;
 
-int main(int argc, char **argv) {
-	volatile unsigned int *mxlradcregs;
-	volatile unsigned int *mxhsadcregs;
-	volatile unsigned int *mxclkctrlregs;
-	unsigned int i, x;
-	unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
-	//signed int bivolt;
-	int devmem;
+/* Longest the HSADC FIFO may stay empty during a sequence */
+#define HSADC_TIMEOUT_US	100000
+
+/* HSADC CTRL1 status bits */
+#define HSADC_FIFO_OVERFLOW	0x2
+#define HSADC_FIFO_EMPTY	0x20
+/* SEQUENCE_SAMPLES_NUM is 24 bits, kept even for whole FIFO words */
+#define HSADC_SEQ_MAX		0xFFFFFE
+
+static volatile sig_atomic_t stop;
+static struct adcwait lradc_wait, hsadc_wait;
 
-	devmem = open("/dev/mem", O_RDWR|O_SYNC);
-	assert(devmem != -1);
+/* Set when the LRADC is read through its IIO driver rather than registers */
+static struct iio_dev *lradc_iio;
 
-	// LRADC
-	mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
-	  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+/* Leaves the LRADC interrupts disabled however main() returns */
+static void adcwait_teardown(void)
+{
+	adcwait_close(&lradc_wait);
+	adcwait_close(&hsadc_wait);
+}
+
+/* Assigns LRADC6:0 to channels 6:0 in the 1.8 V range. With the LRADC
+ * interrupt exported through UIO, their interrupts are enabled so the
+ * waits can sleep on it.
+ */
+static void lradc_setup(volatile unsigned int *mxlradcregs)
+{
+	unsigned int x;
+
+	//Set LRADC6:0 IRQ enable
+	adcwait_irq_enable(&lradc_wait, &mxlradcregs[0x14/4],
+	  &mxlradcregs[0x18/4], 0x7f << 16);
 
 	mxlradcregs[0x148/4] = 0xfffffff; //Clear LRADC6:0 assignments
 	mxlradcregs[0x144/4] = 0x6543210; //Set LRDAC6:0 to channel 6:0
 	mxlradcregs[0x28/4] = 0xff000000; //Set 1.8v range
 	for(x = 0; x < 7; x++)
 	  mxlradcregs[(0x50+(x * 0x10))/4] = 0x0; //Clear LRADCx reg
+}
 
-	for(x = 0; x < 10; x++) {
-		mxlradcregs[0x18/4] = 0x7f; //Clear interrupt ready
-		mxlradcregs[0x4/4] = 0x7f;  //Schedule conversaion of chan 6:0
-		while(!((mxlradcregs[0x10/4] & 0x7f) == 0x7f)); //Wait
-		for(i = 0; i < 7; i++)
+/* The IIO equivalent of lradc_setup(), puts channels 6:0 in the 1.8 V
+ * range. The driver lists the undivided scale first in scale_available.
+ */
+static void lradc_iio_setup(void)
+{
+	char attr[320], scale[32];
+	unsigned int x;
+	FILE *f;
+
+	for (x = 0; x < 7; x++) {
+		snprintf(attr, sizeof(attr), "%s/in_voltage%d_scale_available",
+		  lradc_iio->path, x);
+		f = fopen(attr, "r");
+		if (f == NULL)
+			continue;
+		if (fscanf(f, "%31s", scale) == 1) {
+			snprintf(attr, sizeof(attr), "in_voltage%d_scale", x);
+			iio_write(lradc_iio->path, attr, scale);
+		}
+		fclose(f);
+	}
+}
+
+static int lradc_iio_convert(unsigned int mask, unsigned long long *chan)
+{
+	char attr[32];
+	unsigned int i;
+	long val;
+
+	for (i = 0; i < 7; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		snprintf(attr, sizeof(attr), "in_voltage%d_raw", i);
+		if (iio_read_long(lradc_iio, attr, &val)) {
+			fprintf(stderr, "%s/%s: read failed\n",
+			  lradc_iio->path, attr);
+			return -1;
+		}
+		chan[i] += val & 0xffff;
+	}
+
+	return 0;
+}
+
+/* Converts the channels in mask once, adding each result to chan[]. Returns
+ * -1 if the conversion did not complete.
+ */
+static int lradc_convert(volatile unsigned int *mxlradcregs,
+  unsigned int mask, unsigned long long *chan)
+{
+	unsigned int i;
+
+	if (lradc_iio)
+		return lradc_iio_convert(mask, chan);
+
+	mxlradcregs[0x18/4] = mask; //Clear interrupt ready
+	mxlradcregs[0x4/4] = mask;  //Schedule conversion of the channels
+	if (adcwait(&lradc_wait, &mxlradcregs[0x10/4], mask,
+	  LRADC_TIMEOUT_US)) {
+		fprintf(stderr, "LRADC conversion timed out\n");
+		return -1;
+	}
+	for(i = 0; i < 7; i++) {
+		if (mask & (1 << i))
 		  chan[i] += (mxlradcregs[(0x50+(i * 0x10))/4] & 0xffff);
 	}
 
-	mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-	  devmem, 0x80002000);
-	mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED,
-	  devmem, 0x80040000);
+	return 0;
+}
 
-	// HSADC
+/* mV at the LRADC pin in the 1.8 V range. Board dividers are not applied,
+ * see the comment at the end of main() for those.
+ */
+static unsigned int lradc_mv(unsigned int val)
+{
+	return (val * 45177) / 100000;
+}
+
+static void lradc_header(FILE *out, unsigned int mask)
+{
+	int i;
+
+	fprintf(out, "time_s");
+	for (i = 0; i < 7; i++) {
+		if (mask & (1 << i))
+			fprintf(out, ",ADC%d", i);
+	}
+	fprintf(out, "\n");
+}
+
+/* Writes one frame of the avg conversions summed in chan[]. rel is the
+ * CSV time since the first frame, t the absolute binary time.
+ */
+static int lradc_frame(FILE *out, uint64_t rel, uint64_t t,
+  unsigned long long *chan, unsigned int mask, int avg, int binary, int mv)
+{
+	int i;
+
+	for (i = 0; i < 7; i++) {
+		chan[i] /= avg;
+		if (mv)
+			chan[i] = lradc_mv(chan[i]);
+	}
+
+	if (binary) {
+		fwrite(&t, sizeof(t), 1, out);
+		for (i = 0; i < 7; i++) {
+			uint32_t v = chan[i];
+
+			if (mask & (1 << i))
+				fwrite(&v, sizeof(v), 1, out);
+		}
+	} else {
+		fprintf(out, "%.6f", rel / 1e9);
+		for (i = 0; i < 7; i++) {
+			if (mask & (1 << i))
+				fprintf(out, ",%u", (unsigned int)chan[i]);
+		}
+		fprintf(out, "\n");
+	}
+	if (fflush(out)) {
+		perror("write");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Converts the channels in mask every period of rate_hz, averaging avg
+ * conversions per frame, and writes each frame with the CLOCK_MONOTONIC
+ * time it was started. The mapping and channel setup are done once, so
+ * the only per-frame cost is the conversions themselves.
+ *
+ * CSV is a header then "time_s,ADC<n>,..." rows. Binary frames are a
+ * uint64_t time in ns followed by a uint32_t per channel in mask, in
+ * channel order, all in host byte order.
+ */
+static int lradc_stream(volatile unsigned int *mxlradcregs, FILE *out,
+  unsigned int mask, int rate_hz, int avg, int binary, int mv,
+  long nframes)
+{
+	struct itimerspec its;
+	struct timespec ts;
+	uint64_t exp, missed = 0, t0 = 0, t;
+	unsigned long long chan[7];
+	long n;
+	int tfd, i, ret = 0;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd == -1) {
+		perror("timerfd_create");
+		return 1;
+	}
+	its.it_interval.tv_sec = 1 / rate_hz;
+	its.it_interval.tv_nsec = (1000000000ULL / rate_hz) % 1000000000ULL;
+	its.it_value.tv_sec = 0;
+	its.it_value.tv_nsec = 1;
+	timerfd_settime(tfd, 0, &its, NULL);
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	if (!binary)
+		lradc_header(out, mask);
+
+	for (n = 0; !stop && (nframes == 0 || n < nframes); n++) {
+		if (read(tfd, &exp, sizeof(exp)) != sizeof(exp)) {
+			if (errno != EINTR) {
+				perror("timerfd");
+				ret = 1;
+			}
+			break;
+		}
+		missed += exp - 1;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+		if (n == 0)
+			t0 = t;
+
+		memset(chan, 0, sizeof(chan));
+		for (i = 0; i < avg; i++) {
+			if (lradc_convert(mxlradcregs, mask, chan))
+				break;
+		}
+		if (i < avg ||
+		  lradc_frame(out, t - t0, t, chan, mask, avg, binary, mv)) {
+			ret = 1;
+			break;
+		}
+	}
+	close(tfd);
+
+	fprintf(stderr, "frames=%ld\n", n);
+	fprintf(stderr, "missed_periods=%llu\n", (unsigned long long)missed);
+
+	return ret;
+}
+
+/* Streams like lradc_stream() but from the mxs-lradc IIO buffer, so the
+ * kernel trigger paces the conversions and scans queue up while this is
+ * descheduled instead of being missed. trigger, if given, becomes the
+ * current trigger with its sampling_frequency set to rate_hz. Frame times
+ * are the first scan's timestamp where the driver provides one, otherwise
+ * when the frame was read.
+ */
+static int lradc_stream_buffered(FILE *out, unsigned int mask,
+  const char *trigger, int rate_hz, int avg, int binary, int mv,
+  long nframes)
+{
+	char names[7][16];
+	const char *chans[7];
+	int chmap[7];
+	struct iio_scan scan;
+	struct pollfd pfd;
+	struct timespec ts;
+	unsigned long long chan[7];
+	uint64_t t, t0 = 0;
+	uint8_t *buf;
+	size_t want, got = 0;
+	ssize_t r;
+	long n = 0;
+	int nch = 0, i, j, ret = 0;
+
+	for (i = 0; i < 7; i++) {
+		if (mask & (1 << i)) {
+			snprintf(names[nch], sizeof(names[nch]), "in_voltage%d",
+			  i);
+			chans[nch] = names[nch];
+			chmap[nch++] = i;
+		}
+	}
+	if (trigger && iio_set_trigger(lradc_iio, trigger, rate_hz))
+		return 1;
+	if (iio_buffer_start(lradc_iio, chans, nch, avg * 64, &scan)) {
+		iio_buffer_stop(lradc_iio);
+		return 1;
+	}
+
+	pfd.fd = open(lradc_iio->node, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd == -1) {
+		perror(lradc_iio->node);
+		iio_buffer_stop(lradc_iio);
+		return 1;
+	}
+	pfd.events = POLLIN;
+	want = (size_t)scan.size * avg;
+	buf = malloc(want);
+	assert(buf != NULL);
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	if (!binary)
+		lradc_header(out, mask);
+
+	while (!stop && (nframes == 0 || n < nframes)) {
+		r = read(pfd.fd, buf + got, want - got);
+		if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (r == -1) {
+			perror(lradc_iio->node);
+			ret = 1;
+			break;
+		}
+		if (r == 0)
+			break;
+		got += r;
+		if (got < want)
+			continue;
+		got = 0;
+
+		t = iio_scan_timestamp(&scan, buf);
+		if (scan.ts_offset < 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			t = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+		}
+		if (n == 0)
+			t0 = t;
+
+		memset(chan, 0, sizeof(chan));
+		for (i = 0; i < avg; i++) {
+			for (j = 0; j < nch; j++)
+				chan[chmap[j]] += iio_scan_value(&scan.chans[j],
+				  buf + i * scan.size) & 0xffff;
+		}
+		if (lradc_frame(out, t - t0, t, chan, mask, avg, binary, mv)) {
+			ret = 1;
+			break;
+		}
+		n++;
+	}
+	close(pfd.fd);
+	free(buf);
+	iio_buffer_stop(lradc_iio);
+
+	fprintf(stderr, "frames=%ld\n", n);
+
+	return ret;
+}
+
+/* Brings the HSADC out of reset if needed and powers it up */
+static void hsadc_init(volatile unsigned int *mxhsadcregs,
+  volatile unsigned int *mxclkctrlregs)
+{
 	// Check to see if HSADC needs to be brought out of reset first
 	if(mxhsadcregs[0x0/4] & 0xC0000000) {
 		mxclkctrlregs[0x154/4] = 0x70000000;
@@ -67,12 +396,27 @@ int main(int argc, char **argv) {
 
 	mxhsadcregs[0x28/4] = 0x2000; //Clear powerdown
 	mxhsadcregs[0x24/4] = 0x31;   //Set precharge and SH bypass
-	mxhsadcregs[0x30/4] = 0xa;    //Set sample num
-	mxhsadcregs[0x40/4] = 0x1;    //Set seq num
-	mxhsadcregs[0x04/4] = 0x40000; //12bit mode
+}
+
+/* Starts one sequence of nsamples conversions at 8, 10 or 12 bits,
+ * emptying the FIFO of anything left over first.
+ */
+static int hsadc_start(volatile unsigned int *mxhsadcregs,
+  unsigned int nsamples, int bits)
+{
+	unsigned int x;
 
-	while(!(mxhsadcregs[0x10/4] & 0x20)) {
+	mxhsadcregs[0x30/4] = nsamples; //Set sample num
+	mxhsadcregs[0x40/4] = 0x1;      //Set seq num
+	mxhsadcregs[0x08/4] = 0x60000;  //Clear precision
+	mxhsadcregs[0x04/4] = (bits == 12 ? 2 : (bits == 10 ? 1 : 0)) << 17;
+
+	for (x = 0; !(mxhsadcregs[0x10/4] & HSADC_FIFO_EMPTY); x++) {
 		mxhsadcregs[0x50/4]; //Empty FIFO
+		if (x == 4096) {
+			fprintf(stderr, "HSADC FIFO does not empty\n");
+			return -1;
+		}
 	}
 
 	mxhsadcregs[0x50/4]; //An extra read is necessary
@@ -81,11 +425,818 @@ int main(int argc, char **argv) {
 	mxhsadcregs[0x4/4] = 0x1;         //Set HS_RUN
 	usleep(10);
 	mxhsadcregs[0x4/4] = 0x08000000;      //Start conversion
-	while(!(mxhsadcregs[0x10/4] & 0x1)) ; //Wait for interrupt
 
-	for(i = 0; i < 5; i++) {
-		x = mxhsadcregs[0x50/4];
-		chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+	return 0;
+}
+
+/* Captured FIFO words, two samples each. Sized to a power of two so the
+ * index is a mask; once full, the oldest words are overwritten.
+ */
+struct hsadc_ring {
+	uint32_t *buf;
+	size_t size;
+	uint64_t head;			/* Words ever written */
+};
+
+/* First sample, counting from the start of the capture, of the newest
+ * nsamples held in the ring
+ */
+static uint64_t hsadc_first(const struct hsadc_ring *r, unsigned int nsamples)
+{
+	uint64_t held = (r->head < r->size ? r->head : r->size) * 2;
+
+	return (r->head * 2) - (held < nsamples ? held : nsamples);
+}
+
+/* Writes the newest nsamples in the ring to path as uint16_t in host byte
+ * order, unpacking a chunk at a time.
+ */
+static int hsadc_dump(const struct hsadc_ring *r, const char *path,
+  unsigned int mask, unsigned int nsamples)
+{
+	uint16_t out[2 * 1024];
+	uint64_t i, end = r->head * 2;
+	unsigned int n = 0;
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	for (i = hsadc_first(r, nsamples); i < end; i++) {
+		uint32_t w = r->buf[(i / 2) & (r->size - 1)];
+
+		out[n++] = (w >> (16 * (i & 1))) & mask;
+		if (n == sizeof(out) / sizeof(out[0]) || i + 1 == end) {
+			if (fwrite(out, sizeof(out[0]), n, f) != n) {
+				perror(path);
+				fclose(f);
+				return -1;
+			}
+			n = 0;
+		}
+	}
+
+	return fclose(f) ? -1 : 0;
+}
+
+/* Captures nsamples HSADC samples into a ring buffer and writes them to
+ * path. With continuous set, the longest sequence the HSADC can do is run
+ * until interrupted and the ring keeps the newest nsamples. That is only
+ * about 8 s at 2 Msps, so a long capture restarts the sequence, and the
+ * samples that would have been converted while it restarts are lost. Each
+ * restart is counted as a gap with its duration, and the position of a gap
+ * within the saved samples is reported. The FIFO is only a few words deep
+ * at up to 2 Msps, so it is drained in a tight loop rather than through
+ * adcwait(); a sequence that ends with the overflow flag set lost samples
+ * and is counted as an overrun.
+ */
+static int hsadc_capture(volatile unsigned int *mxhsadcregs,
+  const char *path, unsigned int nsamples, int bits, int continuous)
+{
+	struct hsadc_ring r;
+	struct timespec ts;
+	uint64_t t0, t1, idle, words = 0, overruns = 0, seqs = 0;
+	uint64_t end = 0, gap_ns = 0, gap_at = 0, first;
+	unsigned int mask = (1 << bits) - 1;
+	unsigned int ring_words = (nsamples + 1) / 2, seq_words, got;
+	int ret = 0;
+
+	seq_words = continuous ? HSADC_SEQ_MAX / 2 : ring_words;
+	for (r.size = 1; r.size < ring_words; r.size <<= 1);
+	r.buf = malloc(r.size * sizeof(r.buf[0]));
+	if (r.buf == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	r.head = 0;
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t0 = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+	do {
+		if (hsadc_start(mxhsadcregs, seq_words * 2, bits)) {
+			ret = 1;
+			break;
+		}
+		if (seqs) {
+			/* Nothing was converted from the end of the last
+			 * sequence until now
+			 */
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			gap_ns += ((uint64_t)ts.tv_sec * 1000000000ULL) +
+			  ts.tv_nsec - end;
+			gap_at = r.head;
+		}
+		seqs++;
+		got = 0;
+		idle = 0;
+		while (got < seq_words) {
+			if (mxhsadcregs[0x10/4] & HSADC_FIFO_EMPTY) {
+				if (stop)
+					break;
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				t1 = ((uint64_t)ts.tv_sec * 1000000000ULL) +
+				  ts.tv_nsec;
+				if (idle == 0)
+					idle = t1;
+				else if (t1 - idle > HSADC_TIMEOUT_US * 1000ULL)
+					break;
+				continue;
+			}
+			r.buf[r.head++ & (r.size - 1)] = mxhsadcregs[0x50/4];
+			got++;
+			idle = 0;
+		}
+		words += got;
+		if (mxhsadcregs[0x10/4] & HSADC_FIFO_OVERFLOW)
+			overruns++;
+		if (got < seq_words) {
+			if (!stop) {
+				fprintf(stderr, "HSADC capture timed out\n");
+				ret = 1;
+			}
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		end = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+	} while (continuous && !stop);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+
+	mxhsadcregs[0x8/4] = 0x1; //Clear HS_RUN
+
+	if (words && hsadc_dump(&r, path, mask, nsamples))
+		ret = 1;
+	free(r.buf);
+	first = hsadc_first(&r, nsamples);
+
+	fprintf(stderr, "samples=%llu\n", (unsigned long long)words * 2);
+	fprintf(stderr, "samples_saved=%llu\n",
+	  (unsigned long long)(r.head * 2 - first));
+	fprintf(stderr, "sequences=%llu\n", (unsigned long long)seqs);
+	fprintf(stderr, "duration_us=%llu\n",
+	  (unsigned long long)(t1 - t0) / 1000);
+	fprintf(stderr, "samples_per_sec=%.0f\n",
+	  t1 > t0 ? (words * 2) / ((t1 - t0) / 1e9) : 0.0);
+	fprintf(stderr, "fifo_overruns=%llu\n", (unsigned long long)overruns);
+	fprintf(stderr, "gaps=%llu\n", (unsigned long long)(seqs ? seqs - 1 : 0));
+	fprintf(stderr, "gap_us=%llu\n", (unsigned long long)gap_ns / 1000);
+	/* The ring is smaller than a sequence, so it holds at most one gap */
+	if (gap_at * 2 > first)
+		fprintf(stderr, "gap_at_sample=%llu\n",
+		  (unsigned long long)(gap_at * 2 - first));
+
+	return ret;
+}
+
+enum {
+	TRIG_ABOVE,
+	TRIG_BELOW,
+	TRIG_RISE,
+	TRIG_FALL,
+	TRIG_GPIO,
+};
+
+struct hsadc_trigger {
+	int type;
+	unsigned int level;
+	struct gpiod_chip *chip;
+	struct gpiod_line *line;
+	int fd;
+};
+
+/* Parses above|below|rise|fall:<level> or gpio:<chip>:<offset>[:rise|fall|
+ * both] and requests the GPIO line for edge events.
+ */
+static int hsadc_trigger_parse(struct hsadc_trigger *t, const char *spec)
+{
+	unsigned int chip, offset;
+	char edge[8] = "rise";
+	int ret;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = -1;
+	if (sscanf(spec, "gpio:%u:%u:%7s", &chip, &offset, edge) >= 2) {
+		t->type = TRIG_GPIO;
+		t->chip = gpiod_chip_open_by_number(chip);
+		if (t->chip == NULL) {
+			fprintf(stderr, "Unable to open GPIO chip %u\n", chip);
+			return -1;
+		}
+		t->line = gpiod_chip_get_line(t->chip, offset);
+		if (t->line == NULL)
+			ret = -1;
+		else if (strcmp(edge, "rise") == 0)
+			ret = gpiod_line_request_rising_edge_events(t->line,
+			  "mx28adcctl");
+		else if (strcmp(edge, "fall") == 0)
+			ret = gpiod_line_request_falling_edge_events(t->line,
+			  "mx28adcctl");
+		else if (strcmp(edge, "both") == 0)
+			ret = gpiod_line_request_both_edges_events(t->line,
+			  "mx28adcctl");
+		else
+			ret = -1;
+		if (ret) {
+			fprintf(stderr, "Unable to request GPIO trigger %s\n",
+			  spec);
+			gpiod_chip_close(t->chip);
+			return -1;
+		}
+		t->fd = gpiod_line_event_get_fd(t->line);
+		return 0;
+	}
+
+	if (strncmp(spec, "above:", 6) == 0)
+		t->type = TRIG_ABOVE;
+	else if (strncmp(spec, "below:", 6) == 0)
+		t->type = TRIG_BELOW;
+	else if (strncmp(spec, "rise:", 5) == 0)
+		t->type = TRIG_RISE;
+	else if (strncmp(spec, "fall:", 5) == 0)
+		t->type = TRIG_FALL;
+	else {
+		fprintf(stderr, "Invalid trigger %s\n", spec);
+		return -1;
+	}
+	t->level = strtoul(strchr(spec, ':') + 1, NULL, 0);
+
+	return 0;
+}
+
+/* Discards GPIO trigger edges queued before the trigger was armed */
+static void hsadc_gpio_drain(struct hsadc_trigger *t)
+{
+	struct pollfd pfd = { .fd = t->fd, .events = POLLIN | POLLPRI };
+	struct gpiod_line_event ev;
+
+	while (poll(&pfd, 1, 0) == 1 && !gpiod_line_event_read(t->line, &ev));
+}
+
+/* Returns 1 if the GPIO trigger line has had an edge, with its kernel
+ * timestamp in CLOCK_MONOTONIC ns.
+ */
+static int hsadc_gpio_fired(struct hsadc_trigger *t, uint64_t *ns)
+{
+	struct pollfd pfd = { .fd = t->fd, .events = POLLIN | POLLPRI };
+	struct gpiod_line_event ev;
+	struct timespec mono, real;
+	int64_t ev_ns, mono_ns;
+
+	if (poll(&pfd, 1, 0) != 1 || gpiod_line_event_read(t->line, &ev))
+		return 0;
+	ev_ns = ((int64_t)ev.ts.tv_sec * 1000000000LL) + ev.ts.tv_nsec;
+
+	/* Older kernels stamp events with CLOCK_REALTIME */
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	mono_ns = ((int64_t)mono.tv_sec * 1000000000LL) + mono.tv_nsec;
+	if (mono_ns - ev_ns > 1000000000LL || ev_ns - mono_ns > 1000000000LL) {
+		clock_gettime(CLOCK_REALTIME, &real);
+		ev_ns -= ((int64_t)real.tv_sec * 1000000000LL) + real.tv_nsec -
+		  mono_ns;
+	}
+	*ns = ev_ns;
+
+	return 1;
+}
+
+/* Header of each record written by hsadc_triggered(), followed by
+ * pre + post uint16_t samples, the trigger sample being sample pre. All
+ * fields are host byte order.
+ */
+struct hsadc_record {
+	char magic[4];			/* "HSTR" */
+	uint32_t flags;			/* HSADC_REC_* */
+	uint64_t time_ns;		/* See HSADC_REC_GPIO */
+	uint32_t bits, trigger;
+	uint32_t pre, post;
+};
+
+#define HSADC_REC_OVERFLOW	0x1	/* FIFO overflowed, may have gaps */
+/* time_ns is CLOCK_MONOTONIC. With this flag it is the GPIO edge's kernel
+ * timestamp, otherwise it is when the trigger sample was read from the
+ * FIFO, which is only a few words behind the conversion.
+ */
+#define HSADC_REC_GPIO		0x2
+
+/* How often, in FIFO words, the GPIO trigger is checked. A poll() per word
+ * would not keep up, this bounds the trigger position error to 2048
+ * samples, under 1 ms at 2 Msps.
+ */
+#define HSADC_GPIO_CHECK	1024
+
+/* Captures a window of pre samples before and post samples after each
+ * trigger into records appended to path, ncaptures times or until
+ * interrupted if 0. Samples go through a circular buffer as they are
+ * drained, and the trigger is checked on each one with a compare, so the
+ * loop keeps pace with the FIFO. The pre-trigger history is only valid
+ * from the start of a sequence, so the trigger is armed once pre samples
+ * have been seen, discarding any GPIO edges from before then. Writing a
+ * record overflows the FIFO, so after each record, or a sequence with no
+ * trigger, the sequence restarts and re-arms. Nothing is captured while it
+ * restarts and refills the pre-trigger history; the restarts and the time
+ * spent between sequences are reported.
+ */
+static int hsadc_triggered(volatile unsigned int *mxhsadcregs,
+  const char *path, int bits, struct hsadc_trigger *trig,
+  unsigned int pre, unsigned int post, long ncaptures)
+{
+	struct hsadc_record rec;
+	struct timespec ts, hit_ts;
+	uint16_t *ring, *out, s[2], prev = 0;
+	unsigned int mask = (1 << bits) - 1, seq = HSADC_SEQ_MAX;
+	size_t size;
+	uint64_t n, fired, tns, gpio_ns, idle, end = 0, gap_ns = 0;
+	long captures = 0, restarts = 0;
+	int i, hit, armed, ret = 0;
+	FILE *f;
+
+	/* A word can carry one sample past the window */
+	for (size = 1; size < pre + post + 1; size <<= 1);
+	ring = malloc(size * sizeof(ring[0]));
+	out = malloc((pre + post) * sizeof(out[0]));
+	f = fopen(path, "ab");
+	if (ring == NULL || out == NULL || f == NULL) {
+		perror(f == NULL ? path : "malloc");
+		free(ring);
+		free(out);
+		if (f)
+			fclose(f);
+		return 1;
+	}
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	while (!stop && (ncaptures == 0 || captures < ncaptures)) {
+		if (hsadc_start(mxhsadcregs, seq, bits)) {
+			ret = 1;
+			break;
+		}
+		if (end) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			gap_ns += ((uint64_t)ts.tv_sec * 1000000000ULL) +
+			  ts.tv_nsec - end;
+			restarts++;
+		}
+		n = 0;
+		armed = 0;
+		fired = 0;
+		idle = 0;
+		gpio_ns = 0;
+		while (n < seq) {
+			uint32_t w;
+
+			if (mxhsadcregs[0x10/4] & HSADC_FIFO_EMPTY) {
+				if (stop)
+					break;
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				tns = ((uint64_t)ts.tv_sec * 1000000000ULL) +
+				  ts.tv_nsec;
+				if (idle == 0)
+					idle = tns;
+				else if (tns - idle > HSADC_TIMEOUT_US * 1000ULL)
+					break;
+				continue;
+			}
+			idle = 0;
+			w = mxhsadcregs[0x50/4];
+			s[0] = w & mask;
+			s[1] = (w >> 16) & mask;
+
+			for (i = 0; i < 2; i++, n++) {
+				ring[n & (size - 1)] = s[i];
+				if (fired || n < pre) {
+					prev = s[i];
+					continue;
+				}
+				switch (trig->type) {
+				case TRIG_ABOVE:
+					hit = s[i] >= trig->level;
+					break;
+				case TRIG_BELOW:
+					hit = s[i] <= trig->level;
+					break;
+				case TRIG_RISE:
+					hit = prev < trig->level &&
+					  s[i] >= trig->level;
+					break;
+				case TRIG_FALL:
+					hit = prev > trig->level &&
+					  s[i] <= trig->level;
+					break;
+				default:
+					hit = 0;
+				}
+				prev = s[i];
+				if (hit) {
+					fired = n + 1;
+					clock_gettime(CLOCK_MONOTONIC,
+					  &hit_ts);
+				}
+			}
+
+			if (trig->type == TRIG_GPIO && !fired && n >= pre) {
+				if (!armed) {
+					hsadc_gpio_drain(trig);
+					armed = 1;
+				} else if ((n % (2 * HSADC_GPIO_CHECK)) == 0 &&
+				  hsadc_gpio_fired(trig, &gpio_ns)) {
+					fired = n;
+				}
+			}
+			if (fired && n >= fired - 1 + post)
+				break;
+			if (stop && !fired)
+				break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		end = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+
+		if (!fired || n < fired - 1 + post) {
+			if (!stop && n < seq) {
+				fprintf(stderr, "HSADC capture timed out\n");
+				ret = 1;
+				break;
+			}
+			continue;
+		}
+
+		memcpy(rec.magic, "HSTR", 4);
+		rec.flags = 0;
+		if (mxhsadcregs[0x10/4] & HSADC_FIFO_OVERFLOW)
+			rec.flags |= HSADC_REC_OVERFLOW;
+		if (gpio_ns) {
+			rec.flags |= HSADC_REC_GPIO;
+			rec.time_ns = gpio_ns;
+		} else {
+			rec.time_ns = ((uint64_t)hit_ts.tv_sec * 1000000000ULL) +
+			  hit_ts.tv_nsec;
+		}
+		rec.bits = bits;
+		rec.trigger = pre;
+		rec.pre = pre;
+		rec.post = post;
+
+		/* fired - 1 is the trigger sample */
+		for (n = 0; n < pre + post; n++)
+			out[n] = ring[(fired - 1 - pre + n) & (size - 1)];
+		if (fwrite(&rec, sizeof(rec), 1, f) != 1 ||
+		  fwrite(out, sizeof(out[0]), pre + post, f) != pre + post ||
+		  fflush(f)) {
+			perror(path);
+			ret = 1;
+			break;
+		}
+		captures++;
+		fprintf(stderr, "capture=%ld%s\n", captures,
+		  rec.flags & HSADC_REC_OVERFLOW ? " overflow" : "");
+	}
+	mxhsadcregs[0x8/4] = 0x1; //Clear HS_RUN
+
+	fclose(f);
+	free(ring);
+	free(out);
+	fprintf(stderr, "captures=%ld\n", captures);
+	fprintf(stderr, "restarts=%ld\n", restarts);
+	fprintf(stderr, "restart_gap_us=%llu\n",
+	  (unsigned long long)gap_ns / 1000);
+
+	return ret;
+}
+
+static void usage(char **argv) {
+	fprintf(stderr,
+	  "%s\n\n"
+	  "Usage: %s [OPTION] ...\n"
+	  "embeddedTS i.MX28 LRADC/HSADC sampling.\n"
+	  "With no options, prints the average of 10 conversions of every\n"
+	  "channel.\n"
+	  "\n"
+	  "  -s, --stream           Sample LRADC channels continuously\n"
+	  "  -c, --channels <mask>  LRADC channels to stream, default 0x7f\n"
+	  "  -r, --rate <hz>        Frames per second, default 10\n"
+	  "  -a, --average <n>      Conversions averaged per frame, default 1\n"
+	  "  -n, --frames <n>       Stop after <n> frames, default never\n"
+	  "  -m, --mv               Output mV at the LRADC pin, not raw counts\n"
+	  "  -b, --binary           Output binary frames, a uint64_t ns time\n"
+	  "                           then a uint32_t per channel\n"
+	  "  -o, --output <file>    Write frames to <file>, default stdout\n"
+	  "  -S, --stats            Print ADC wait counters to stderr\n"
+	  "  -H, --hsadc <file>     Capture HSADC samples to <file> as\n"
+	  "                           uint16_t\n"
+	  "  -N, --hsadc-samples <n> Samples to capture, default 4096\n"
+	  "  -B, --hsadc-bits <n>   HSADC resolution, 8, 10 or 12 (default)\n"
+	  "  -C, --hsadc-continuous Capture until interrupted, keeping the\n"
+	  "                           last --hsadc-samples\n"
+	  "  -T, --trigger <spec>   With --hsadc, append a record to <file>\n"
+	  "                           around each trigger, one of\n"
+	  "                           above|below|rise|fall:<level>, or\n"
+	  "                           gpio:<chip>:<offset>[:rise|fall|both]\n"
+	  "  -p, --pre <n>          Samples kept before the trigger, default\n"
+	  "                           1024\n"
+	  "  -P, --post <n>         Samples after the trigger, default 1024\n"
+	  "  -t, --captures <n>     Stop after <n> records, default 1, 0 for\n"
+	  "                           until interrupted\n"
+	  "  -k, --backend <name>   ADC access, mmio (default) for the\n"
+	  "                           registers or iio for the kernel driver\n"
+	  "  -u, --buffered         With --stream and the iio backend, read\n"
+	  "                           the IIO buffer rather than timed reads\n"
+	  "  -g, --iio-trigger <name> IIO trigger for --buffered, run at\n"
+	  "                           --rate where it has a sampling_frequency\n"
+	  "  -h, --help             This help\n"
+	  "\n"
+	  "ADC_BACKEND selects a backend like --backend. The iio backend uses\n"
+	  "/sys/bus/iio/devices and /dev unless IIO_ROOT and IIO_DEV are set.\n"
+	  "HSADC capture is only available through mmio.\n",
+	  copyright, argv[0]
+	);
+}
+
+int main(int argc, char **argv) {
+	volatile unsigned int *mxlradcregs;
+	volatile unsigned int *mxhsadcregs;
+	volatile unsigned int *mxclkctrlregs;
+	unsigned int i, x;
+	unsigned long long chan[8] = {0,0,0,0,0,0,0,0};
+	//signed int bivolt;
+	int devmem, c, ret;
+	int opt_stream = 0, opt_rate = 10, opt_avg = 1, opt_mv = 0;
+	int opt_binary = 0, opt_stats = 0;
+	unsigned int opt_mask = 0x7f;
+	long opt_frames = 0;
+	char *opt_output = NULL;
+	char *opt_hsadc = NULL;
+	unsigned int opt_hs_samples = 4096;
+	int opt_hs_bits = 12, opt_hs_continuous = 0;
+	char *opt_trigger = NULL;
+	unsigned int opt_pre = 1024, opt_post = 1024;
+	long opt_captures = 1;
+	unsigned long ul;
+	char *end;
+	struct hsadc_trigger trig;
+	char *opt_backend = NULL, *opt_iio_trigger = NULL;
+	int opt_buffered = 0, use_iio, hsadc_iio = 0;
+	struct iio_dev lradc_dev, hsadc_dev;
+	FILE *out = stdout;
+	static struct option long_options[] = {
+	  { "stream", 0, 0, 's' },
+	  { "channels", 1, 0, 'c' },
+	  { "rate", 1, 0, 'r' },
+	  { "average", 1, 0, 'a' },
+	  { "frames", 1, 0, 'n' },
+	  { "mv", 0, 0, 'm' },
+	  { "binary", 0, 0, 'b' },
+	  { "output", 1, 0, 'o' },
+	  { "stats", 0, 0, 'S' },
+	  { "hsadc", 1, 0, 'H' },
+	  { "hsadc-samples", 1, 0, 'N' },
+	  { "hsadc-bits", 1, 0, 'B' },
+	  { "hsadc-continuous", 0, 0, 'C' },
+	  { "trigger", 1, 0, 'T' },
+	  { "pre", 1, 0, 'p' },
+	  { "post", 1, 0, 'P' },
+	  { "captures", 1, 0, 't' },
+	  { "backend", 1, 0, 'k' },
+	  { "buffered", 0, 0, 'u' },
+	  { "iio-trigger", 1, 0, 'g' },
+	  { "help", 0, 0, 'h' },
+	  { 0, 0, 0, 0 }
+	};
+
+	while((c = getopt_long(argc, argv, "sc:r:a:n:mbo:SH:N:B:CT:p:P:t:k:ug:h", long_options,
+	  NULL)) != -1) {
+		switch (c) {
+		case 's':
+			opt_stream = 1;
+			break;
+		case 'c':
+			opt_mask = strtoul(optarg, NULL, 0);
+			if (opt_mask == 0 || opt_mask > 0x7f) {
+				fprintf(stderr, "Invalid channel mask\n");
+				return 1;
+			}
+			break;
+		case 'r':
+			opt_rate = atoi(optarg);
+			if (opt_rate < 1 || opt_rate > 100000) {
+				fprintf(stderr, "Invalid rate\n");
+				return 1;
+			}
+			break;
+		case 'a':
+			opt_avg = atoi(optarg);
+			if (opt_avg < 1) {
+				fprintf(stderr, "Invalid average count\n");
+				return 1;
+			}
+			break;
+		case 'n':
+			opt_frames = atol(optarg);
+			break;
+		case 'm':
+			opt_mv = 1;
+			break;
+		case 'b':
+			opt_binary = 1;
+			break;
+		case 'o':
+			opt_output = optarg;
+			break;
+		case 'S':
+			opt_stats = 1;
+			break;
+		case 'H':
+			opt_hsadc = optarg;
+			break;
+		case 'N':
+			opt_hs_samples = strtoul(optarg, NULL, 0);
+			if (opt_hs_samples < 2 || opt_hs_samples > 0x100000) {
+				fprintf(stderr, "Invalid sample count\n");
+				return 1;
+			}
+			break;
+		case 'B':
+			opt_hs_bits = atoi(optarg);
+			if (opt_hs_bits != 8 && opt_hs_bits != 10 &&
+			  opt_hs_bits != 12) {
+				fprintf(stderr, "Invalid HSADC resolution\n");
+				return 1;
+			}
+			break;
+		case 'C':
+			opt_hs_continuous = 1;
+			break;
+		case 'T':
+			opt_trigger = optarg;
+			break;
+		case 'p':
+		case 'P':
+			ul = strtoul(optarg, &end, 0);
+			if (end == optarg || *end || ul > 0x100000) {
+				fprintf(stderr, "Invalid trigger window\n");
+				return 1;
+			}
+			if (c == 'p')
+				opt_pre = ul;
+			else
+				opt_post = ul;
+			break;
+		case 't':
+			opt_captures = strtol(optarg, &end, 0);
+			if (end == optarg || *end || opt_captures < 0) {
+				fprintf(stderr, "Invalid capture count\n");
+				return 1;
+			}
+			break;
+		case 'k':
+			opt_backend = optarg;
+			break;
+		case 'u':
+			opt_buffered = 1;
+			break;
+		case 'g':
+			opt_iio_trigger = optarg;
+			break;
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (opt_backend == NULL)
+		opt_backend = getenv("ADC_BACKEND");
+	use_iio = iio_backend(opt_backend);
+	if (use_iio == -1)
+		return 1;
+	if (use_iio && opt_hsadc) {
+		fprintf(stderr, "HSADC capture needs the mmio backend\n");
+		return 1;
+	}
+	if (opt_buffered && !use_iio) {
+		fprintf(stderr, "--buffered needs the iio backend\n");
+		return 1;
+	}
+
+	if (use_iio) {
+		if (iio_find(&lradc_dev, "mxs-lradc")) {
+			fprintf(stderr, "No mxs-lradc IIO device in %s\n",
+			  iio_root());
+			return 1;
+		}
+		lradc_iio = &lradc_dev;
+		lradc_iio_setup();
+		hsadc_iio = iio_find(&hsadc_dev, "mxs-hsadc") == 0;
+	}
+
+	/* Without an HSADC IIO driver, its one-shot read still uses the
+	 * registers when the LRADC goes through IIO.
+	 */
+	mxlradcregs = mxhsadcregs = mxclkctrlregs = NULL;
+	if (!use_iio || (!opt_stream && !hsadc_iio)) {
+		devmem = open("/dev/mem", O_RDWR|O_SYNC);
+		assert(devmem != -1);
+
+		// LRADC
+		mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
+		  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
+
+		mxhsadcregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE,
+		  MAP_SHARED, devmem, 0x80002000);
+		mxclkctrlregs = mmap(0, getpagesize(), PROT_READ|PROT_WRITE,
+		  MAP_SHARED, devmem, 0x80040000);
+
+		adcwait_open(&lradc_wait, "mxs-lradc");
+		adcwait_open(&hsadc_wait, NULL);
+		atexit(adcwait_teardown);
+	}
+
+	if (opt_hsadc && opt_trigger) {
+		if (opt_post < 1 || opt_pre + opt_post > 0x100000) {
+			fprintf(stderr, "Invalid trigger window\n");
+			return 1;
+		}
+		if (hsadc_trigger_parse(&trig, opt_trigger))
+			return 1;
+		hsadc_init(mxhsadcregs, mxclkctrlregs);
+		ret = hsadc_triggered(mxhsadcregs, opt_hsadc, opt_hs_bits,
+		  &trig, opt_pre, opt_post, opt_captures);
+		if (trig.chip) {
+			gpiod_line_release(trig.line);
+			gpiod_chip_close(trig.chip);
+		}
+		return ret;
+	}
+
+	if (opt_hsadc) {
+		hsadc_init(mxhsadcregs, mxclkctrlregs);
+		return hsadc_capture(mxhsadcregs, opt_hsadc, opt_hs_samples,
+		  opt_hs_bits, opt_hs_continuous);
+	}
+
+	if (!use_iio)
+		lradc_setup(mxlradcregs);
+
+	if (opt_stream) {
+		if (opt_output) {
+			out = fopen(opt_output, opt_binary ? "wb" : "w");
+			if (out == NULL) {
+				perror(opt_output);
+				return 1;
+			}
+		}
+		if (opt_buffered)
+			ret = lradc_stream_buffered(out, opt_mask,
+			  opt_iio_trigger, opt_rate, opt_avg, opt_binary,
+			  opt_mv, opt_frames);
+		else
+			ret = lradc_stream(mxlradcregs, out, opt_mask,
+			  opt_rate, opt_avg, opt_binary, opt_mv, opt_frames);
+		if (out != stdout)
+			fclose(out);
+		if (opt_stats && !use_iio)
+			adcwait_stats(&lradc_wait, "lradc", stderr);
+		return ret;
+	}
+
+	for(x = 0; x < 10; x++) {
+		if (lradc_convert(mxlradcregs, 0x7f, chan))
+			return 1;
+	}
+
+	// HSADC
+	if (hsadc_iio) {
+		long val;
+
+		for (i = 0; i < 10; i++) {
+			if (iio_read_long(&hsadc_dev, "in_voltage0_raw", &val)) {
+				fprintf(stderr, "%s/in_voltage0_raw: read "
+				  "failed\n", hsadc_dev.path);
+				return 1;
+			}
+			chan[7] += val & 0xfff;
+		}
+	} else {
+		hsadc_init(mxhsadcregs, mxclkctrlregs);
+
+		if (hsadc_start(mxhsadcregs, 10, 12))
+			return 1;
+		//Wait for interrupt
+		if (adcwait(&hsadc_wait, &mxhsadcregs[0x10/4], 0x1,
+		  HSADC_TIMEOUT_US)) {
+			fprintf(stderr, "HSADC conversion timed out\n");
+			return 1;
+		}
+
+		for(i = 0; i < 5; i++) {
+			x = mxhsadcregs[0x50/4];
+			chan[7] += ((x & 0xfff) + ((x >> 16) & 0xfff));
+		}
 	}
 
 	/* This is where value to voltage conversions would take
@@ -147,5 +1298,12 @@ int main(int argc, char **argv) {
 	}
 	printf("HSADC_val=0x%x\n", (unsigned int)chan[7]/10);
 
+	if (opt_stats) {
+		if (!use_iio)
+			adcwait_stats(&lradc_wait, "lradc", stderr);
+		if (!hsadc_iio)
+			adcwait_stats(&hsadc_wait, "hsadc", stderr);
+	}
+
 	return 0;
 }
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Pulse counting on CPU GPIO lines from libgpiod edge events. The kernel
+ * timestamps every rising edge as it happens, so counts and frequencies
+ * are exact no matter when this process gets to read them, and between
+ * reads it sleeps in poll(). Lines are requested one at a time, not as a
+ * bulk, so they may come from different chips.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pulse.h"
+
+/* Depth of the kernel's per-line event queue. A read that returns this many
+ * events found the queue full, and the kernel drops edges while it is, so
+ * such a read means some edges may not have been counted.
+ */
+#define PULSE_QUEUE		16
+
+static int pulse_add(struct pulse_counter *pc, const char *spec)
+{
+	struct pulse_line *pl = &pc->lines[pc->nlines];
+	unsigned int chipnum, offset;
+	char c;
+
+	if (pc->nlines == PULSE_MAX_LINES) {
+		fprintf(stderr, "Too many lines to count, %d max\n",
+		  PULSE_MAX_LINES);
+		return -1;
+	}
+
+	memset(pl, 0, sizeof(*pl));
+	snprintf(pl->name, sizeof(pl->name), "%s", spec);
+
+	/* <chip>:<offset>, or a line name from the device tree */
+	if (sscanf(spec, "%u:%u%c", &chipnum, &offset, &c) == 2) {
+		pl->chip = gpiod_chip_open_by_number(chipnum);
+		if (pl->chip == NULL) {
+			fprintf(stderr, "Unable to open GPIO chip %u\n",
+			  chipnum);
+			return -1;
+		}
+		pl->line = gpiod_chip_get_line(pl->chip, offset);
+	} else {
+		pl->line = gpiod_line_find(spec);
+	}
+	if (pl->line == NULL) {
+		fprintf(stderr, "Unable to find GPIO line %s\n", spec);
+		if (pl->chip)
+			gpiod_chip_close(pl->chip);
+		return -1;
+	}
+
+	if (gpiod_line_request_rising_edge_events(pl->line, "tshwctl")) {
+		fprintf(stderr, "Unable to request edge events on %s\n",
+		  spec);
+		if (pl->chip)
+			gpiod_chip_close(pl->chip);
+		else
+			gpiod_line_close_chip(pl->line);
+		return -1;
+	}
+	pl->fd = gpiod_line_event_get_fd(pl->line);
+	pc->nlines++;
+
+	return 0;
+}
+
+/* Requests rising edge events on a comma separated list of lines */
+int pulse_open(struct pulse_counter *pc, const char *spec)
+{
+	char *list = strdup(spec), *tok, *save;
+	int ret = 0;
+
+	pc->nlines = 0;
+	for (tok = strtok_r(list, ",", &save); tok;
+	  tok = strtok_r(NULL, ",", &save)) {
+		if (pulse_add(pc, tok)) {
+			ret = -1;
+			break;
+		}
+	}
+	free(list);
+
+	if (ret == 0 && pc->nlines == 0) {
+		fprintf(stderr, "No lines to count\n");
+		ret = -1;
+	}
+	if (ret)
+		pulse_close(pc);
+
+	return ret;
+}
+
+static void pulse_edge(struct pulse_line *pl, const struct timespec *ts)
+{
+	uint64_t ns = ((uint64_t)ts->tv_sec * 1000000000ULL) + ts->tv_nsec;
+
+	if (pl->count == 0) {
+		pl->first_ns = pl->mark_ns = ns;
+		pl->mark_count = 1;
+	} else if (ns > pl->last_ns) {
+		pl->inst_hz = 1e9 / (ns - pl->last_ns);
+	}
+	pl->last_ns = ns;
+	pl->count++;
+}
+
+/* Waits up to timeout_ms for edges on any line and takes in everything that
+ * is queued. Returns the number of edges, 0 on timeout or a signal, or -1.
+ */
+int pulse_wait(struct pulse_counter *pc, int timeout_ms)
+{
+	struct pollfd fds[PULSE_MAX_LINES];
+	struct gpiod_line_event ev[PULSE_QUEUE];
+	int i, j, n, ret, total = 0;
+
+	for (i = 0; i < pc->nlines; i++) {
+		fds[i].fd = pc->lines[i].fd;
+		fds[i].events = POLLIN | POLLPRI;
+	}
+
+	ret = poll(fds, pc->nlines, timeout_ms);
+	if (ret == -1) {
+		if (errno == EINTR)
+			return 0;
+		perror("poll");
+		return -1;
+	}
+
+	for (i = 0; i < pc->nlines; i++) {
+		struct pulse_line *pl = &pc->lines[i];
+
+		if (!fds[i].revents)
+			continue;
+		/* One read per wakeup, the event fd blocks when empty */
+		n = gpiod_line_event_read_multiple(pl->line, ev, PULSE_QUEUE);
+		if (n < 0) {
+			perror(pl->name);
+			return -1;
+		}
+		if (n == PULSE_QUEUE)
+			pl->full_reads++;
+		for (j = 0; j < n; j++)
+			pulse_edge(pl, &ev[j].ts);
+		total += n;
+	}
+
+	return total;
+}
+
+/* Average frequency from the first edge to the last */
+double pulse_avg_hz(const struct pulse_line *pl)
+{
+	if (pl->count < 2 || pl->last_ns == pl->first_ns)
+		return 0;
+
+	return (pl->count - 1) * 1e9 / (pl->last_ns - pl->first_ns);
+}
+
+/* Frequency over the edges since the previous call, measured between edge
+ * timestamps so it does not depend on when this is called. Returns 0 if
+ * there were no new edges.
+ */
+double pulse_mark(struct pulse_line *pl)
+{
+	double hz = 0;
+
+	if (pl->count > pl->mark_count && pl->last_ns > pl->mark_ns)
+		hz = (pl->count - pl->mark_count) * 1e9 /
+		  (pl->last_ns - pl->mark_ns);
+	pl->mark_count = pl->count;
+	pl->mark_ns = pl->last_ns;
+
+	return hz;
+}
+
+void pulse_close(struct pulse_counter *pc)
+{
+	int i;
+
+	for (i = 0; i < pc->nlines; i++) {
+		struct pulse_line *pl = &pc->lines[i];
+
+		gpiod_line_release(pl->line);
+		if (pl->chip)
+			gpiod_chip_close(pl->chip);
+		else
+			gpiod_line_close_chip(pl->line);
+	}
+	pc->nlines = 0;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __PULSE_H_
+#define __PULSE_H_
+
+#include <stdint.h>
+#include <gpiod.h>
+
+#define PULSE_MAX_LINES		8
+
+struct pulse_line {
+	char name[32];
+	struct gpiod_chip *chip;
+	struct gpiod_line *line;
+	int fd;
+	uint64_t count;			/* Rising edges since open */
+	uint64_t first_ns, last_ns;	/* Kernel timestamps */
+	double inst_hz;			/* From the last two edges */
+	uint64_t mark_count, mark_ns;	/* As of the last pulse_mark() */
+	uint64_t full_reads;		/* Reads that emptied a full queue */
+};
+
+struct pulse_counter {
+	int nlines;
+	struct pulse_line lines[PULSE_MAX_LINES];
+};
+
+int pulse_open(struct pulse_counter *pc, const char *spec);
+int pulse_wait(struct pulse_counter *pc, int timeout_ms);
+double pulse_avg_hz(const struct pulse_line *pl);
+double pulse_mark(struct pulse_line *pl);
+void pulse_close(struct pulse_counter *pc);
+
+#endif
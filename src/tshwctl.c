@@ -16,12 +16,26 @@
 #include <stdint.h>
 #include <linux/types.h>
 #include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
 
+#include "adcwait.h"
+#include "autotx.h"
+#include "bustrace.h"
+#include "crossbar.h"
+#include "dac.h"
 #include "fpga.h"
-#include "crossbar-ts7680.h"
-#include "crossbar-ts7682.h"
+#include "iio.h"
+#include "pulse.h"
+#include "tshwctld.h"
 
 static int twifd;
+static const struct cbar_model *cbar;
+static volatile sig_atomic_t stop;
 
 const char copyright[] = "Copyright (c) embeddedTS - " __DATE__ " - "
   GITCOMMIT;
@@ -42,55 +56,1342 @@ int get_model()
 	return strtoull(ptr+3, NULL, 16);
 }
 
-void autotx_bitstoclks(int bits, int baud, uint32_t *cnt1, uint32_t *cnt2)
+/* Opened without becoming the controlling tty or waiting for carrier. Keep
+ * the fd for as long as the tty is being looked at: with HUPCL set, the
+ * close of the last fd drops DTR and RTS.
+ */
+static int uart_open(const char *tty)
 {
-	bits *= 10;
-	*cnt1 = (2500000/(baud/(bits-5)));
-	*cnt2 = (2500000/(baud/5));
+	int fd = open(tty, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+
+	if (fd == -1)
+		perror(tty);
+
+	return fd;
+}
+
+/* Reads the line settings of an open tty into baud and mode, e.g. "8n1" */
+static int uart_get_config(int fd, const char *tty, int *baud, char *mode)
+{
+	static const struct {
+		speed_t speed;
+		int baud;
+	} speeds[] = {
+		{ B300, 300 }, { B600, 600 }, { B1200, 1200 },
+		{ B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 },
+		{ B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 },
+		{ B115200, 115200 }, { B230400, 230400 },
+		{ B460800, 460800 }, { B500000, 500000 },
+		{ B576000, 576000 }, { B921600, 921600 },
+		{ B1000000, 1000000 }, { B1152000, 1152000 },
+		{ B1500000, 1500000 }, { B2000000, 2000000 },
+		{ B2500000, 2500000 }, { B3000000, 3000000 },
+	};
+	struct termios tio;
+	speed_t speed;
+	int i;
+
+	if (tcgetattr(fd, &tio)) {
+		perror(tty);
+		return -1;
+	}
+
+	speed = cfgetospeed(&tio);
+	*baud = 0;
+	for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].speed == speed)
+			*baud = speeds[i].baud;
+	}
+	if (*baud == 0) {
+		fprintf(stderr, "%s: Unsupported baud rate\n", tty);
+		return -1;
+	}
+
+	switch (tio.c_cflag & CSIZE) {
+	case CS5: mode[0] = '5'; break;
+	case CS6: mode[0] = '6'; break;
+	case CS7: mode[0] = '7'; break;
+	default: mode[0] = '8'; break;
+	}
+	if (!(tio.c_cflag & PARENB))
+		mode[1] = 'n';
+	else
+		mode[1] = (tio.c_cflag & PARODD) ? 'o' : 'e';
+	mode[2] = (tio.c_cflag & CSTOPB) ? '2' : '1';
+	mode[3] = '\0';
+
+	return 0;
+}
+
+/* The CPU UART behind TXEN counter uart, unless --tty names another */
+static const char *uart_tty(int uart, const char *tty)
+{
+	static char path[32];
+
+	if (tty)
+		return tty;
+	snprintf(path, sizeof(path), "/dev/ttyAPP%d", uart);
+	return path;
+}
+
+/* Six registers of TXEN counters per CPU UART 0-4, up to the TTYMAX pads */
+#define TXEN_REG		0x36
+#define TXEN_UARTS		5
+
+/* TXEN held past the last stop bit, and --txen-check, for auto485_en() */
+static int txen_guard_ns;
+static int txen_check;
+
+/* Programs the TXEN counters for uart. A baud of 0 or a NULL mode is taken
+ * from the tty's current termios settings. Returns -1 if neither is known.
+ * With txen_check set, prints the timing and its simulation instead.
+ */
+int auto485_en(int uart, int baud, const char *mode, const char *tty)
+{
+	struct autotx_timing t;
+	int i, tbaud, fd, err;
+	char tmode[4];
+
+	if (uart < 0 || uart >= TXEN_UARTS) {
+		fprintf(stderr, "No Auto TXEN for UART %d, only 0-%d\n", uart,
+		  TXEN_UARTS - 1);
+		return -1;
+	}
+
+	if (baud == 0 || mode == NULL) {
+		tty = uart_tty(uart, tty);
+		fd = uart_open(tty);
+		err = fd == -1 || uart_get_config(fd, tty, &tbaud, tmode);
+		if (fd != -1)
+			close(fd);
+		if (err) {
+			fprintf(stderr, "Give the baud rate and mode, or a "
+			  "tty to read them from\n");
+			return -1;
+		}
+		if (baud == 0) baud = tbaud;
+		if (mode == NULL) mode = tmode;
+	}
+
+	if (autotx_compute(&t, baud, mode, txen_guard_ns))
+		return -1;
+	if (txen_check) {
+		printf("mode=%s\n", mode);
+		return autotx_check(&t, stdout);
+	}
+	printf("Setting Auto TXEN for %d baud, %d bits per symbol (%s)\n",
+	  baud, t.symsz, mode);
+	/* Staged in the shadow cache, the caller's flush sends both 24-bit
+	 * counters in one burst so the FPGA never sees a half-updated pair.
+	 */
+	i = TXEN_REG + (uart * 6);
+	fpga_cache_poke(i++, (uint8_t)((t.cnt1 & 0xff0000) >> 16));
+	fpga_cache_poke(i++, (uint8_t)((t.cnt1 & 0xff00) >> 8));
+	fpga_cache_poke(i++, (uint8_t)(t.cnt1 & 0xff));
+	fpga_cache_poke(i++, (uint8_t)((t.cnt2 & 0xff0000) >> 16));
+	fpga_cache_poke(i++, (uint8_t)((t.cnt2 & 0xff00) >> 8));
+	fpga_cache_poke(i++, (uint8_t)(t.cnt2 & 0xff));
+
+	return 0;
+}
+
+/* Loads every crossbar register into the FPGA shadow cache with one block
+ * transfer. The outputs tables are sparse, so this spans from the lowest to
+ * the highest pad address.
+ */
+int cbar_load(void)
+{
+	return fpga_cache_load(twifd, cbar->lo, (cbar->hi - cbar->lo) + 1);
+}
+
+/* Routes the named FPGA input to the named pad in the shadow cache, the
+ * caller flushes. Through tshwctld the daemon does the read-modify-write
+ * right away instead, so it cannot race another client's change to the
+ * same register. Returns -1 if either name is unknown.
+ */
+int cbar_assign(const char *pad, const char *input)
+{
+	const struct cbarpin *out, *in;
+	char req[TSHWCTLD_MAX_DATA + 1];
+
+	out = cbar_find_output(cbar, pad);
+	if (out == NULL) {
+		fprintf(stderr, "Invalid output %s\n", pad);
+		return -1;
+	}
+
+	in = cbar_find_input(cbar, input);
+	if (in == NULL) {
+		fprintf(stderr, "Invalid value \"%s\" for input %s\n",
+		  input, pad);
+		return -1;
+	}
+
+	if (fpga_is_remote()) {
+		/* Drops anything staged for the pad, the daemon's write is
+		 * the newer one
+		 */
+		fpga_cache_invalidate(out->addr, 1);
+		if (snprintf(req, sizeof(req), "%s=%s", pad, input) >=
+		  (int)sizeof(req))
+			return -1;
+		return fpga_remote_cbar(twifd, TSHWCTLD_CBAR_SET, req, NULL, 0);
+	}
+
+	return fpga_cache_rmw(twifd, out->addr, ~cbar->mask,
+	  in->addr << (8 - cbar->size));
+}
+
+/* Name of the input a pad register value routes, for display */
+const char *cbar_mode_name(uint8_t value)
+{
+	const char *name = cbar_input_name(cbar, value >> (8 - cbar->size));
+
+	return name ? name : "UNKNOWN";
+}
+
+/* Writes the crossbar state to path, or stdout if path is "-", as a
+ * PAD=0xNN line per pad with the whole register: the mode and the GPIO
+ * direction and value bits. The input name follows as a comment. The
+ * shadow cache must be loaded.
+ */
+int cbar_save_profile(const char *path)
+{
+	FILE *f;
+	int i;
+
+	f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	fprintf(f, "# TS-%X crossbar profile\n", cbar->model);
+	for (i = 0; i < cbar->noutputs; i++) {
+		int value = fpga_cache_peek(twifd, cbar->outputs[i].addr);
+
+		if (value < 0) {
+			if (f != stdout)
+				fclose(f);
+			return 1;
+		}
+		fprintf(f, "%s=0x%02X # %s\n", cbar->outputs[i].name, value,
+		  cbar_mode_name(value));
+	}
+
+	if (f != stdout && fclose(f)) {
+		perror(path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Register value of a PAD=0xNN profile entry, -1 if it is not one */
+static int profile_raw(const char *value)
+{
+	unsigned long v;
+	char *end;
+
+	if (strncmp(value, "0x", 2) && strncmp(value, "0X", 2))
+		return -1;
+	v = strtoul(value + 2, &end, 16);
+	if (end == value + 2 || *end != 0 || v > 0xff)
+		return -1;
+
+	return v;
+}
+
+/* Applies a profile written by cbar_save_profile(). A PAD=0xNN line restores
+ * the whole pad register, a hand-written PAD=INPUT line only changes the
+ * routing, as --set does. Every line is checked before anything is
+ * written. The registers are diffed against the shadow cache so only pads
+ * that change are written, coalesced into as few bursts as possible to
+ * keep the window with a partially applied profile short.
+ */
+int cbar_apply_profile(const char *path)
+{
+	FILE *f;
+	char buf[256], *input, *end;
+	char **pads = NULL, **inputs = NULL;
+	int line = 0, n = 0, i, ret = 0;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		line++;
+		buf[strcspn(buf, "#\r\n")] = 0;
+		for (end = buf + strlen(buf); end > buf &&
+		  (end[-1] == ' ' || end[-1] == '\t'); end--)
+			end[-1] = 0;
+		if (buf[0] == 0)
+			continue;
+
+		input = strchr(buf, '=');
+		if (input == NULL) {
+			fprintf(stderr, "%s:%d: expected PAD=INPUT or "
+			  "PAD=0xNN\n", path, line);
+			ret = 1;
+			continue;
+		}
+		*input++ = 0;
+		if (cbar_find_output(cbar, buf) == NULL ||
+		  (profile_raw(input) < 0 &&
+		  cbar_find_input(cbar, input) == NULL)) {
+			fprintf(stderr, "%s:%d: unknown %s=%s\n", path, line,
+			  buf, input);
+			ret = 1;
+			continue;
+		}
+
+		pads = realloc(pads, sizeof(*pads) * (n + 1));
+		inputs = realloc(inputs, sizeof(*inputs) * (n + 1));
+		assert(pads != NULL && inputs != NULL);
+		pads[n] = strdup(buf);
+		inputs[n] = strdup(input);
+		n++;
+	}
+	if (f != stdin)
+		fclose(f);
+
+	for (i = 0; i < n; i++) {
+		int raw = profile_raw(inputs[i]);
+
+		if (!ret && raw >= 0)
+			fpga_cache_poke(cbar_find_output(cbar, pads[i])->addr,
+			  raw);
+		else if (!ret && cbar_assign(pads[i], inputs[i]))
+			ret = 1;
+		free(pads[i]);
+		free(inputs[i]);
+	}
+	free(pads);
+	free(inputs);
+
+	if (!ret)
+		ret = fpga_cache_flush(twifd) ? 1 : 0;
+
+	return ret;
+}
+
+/* Applies "PAD=VAL,..." where VAL is 0 or 1 to drive the pad or "in" to
+ * make it an input. All pads are validated first, then the whole change is
+ * read from and written back to the FPGA in one block read and one burst.
+ */
+int gpio_set(char *spec)
+{
+	char *tok, *save, *val;
+	const struct cbarpin *pads[32];
+	int outs[32], vals[32];
+	int n = 0, i;
+
+	for (tok = strtok_r(spec, ",", &save); tok != NULL;
+	  tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL || n == 32) {
+			fprintf(stderr, "Invalid GPIO setting %s\n", tok);
+			return 1;
+		}
+		*val++ = 0;
+
+		pads[n] = cbar_find_output(cbar, tok);
+		if (pads[n] == NULL || pads[n]->addr < cbar->gpio_lo ||
+		  pads[n]->addr >= cbar->gpio_lo + cbar->gpio_count) {
+			fprintf(stderr, "%s is not an FPGA GPIO pad\n", tok);
+			return 1;
+		}
+		if (strcmp(val, "in") == 0) {
+			outs[n] = 0;
+			vals[n] = 0;
+		} else if (strcmp(val, "0") == 0 || strcmp(val, "1") == 0) {
+			outs[n] = 1;
+			vals[n] = val[0] == '1';
+		} else {
+			fprintf(stderr, "Invalid value %s for %s\n", val, tok);
+			return 1;
+		}
+		n++;
+	}
+
+	if (cbar->gpio_count && fpga_cache_load(twifd, cbar->gpio_lo,
+	  cbar->gpio_count))
+		return 1;
+	for (i = 0; i < n; i++) {
+		if (cbar_gpio_set(cbar, twifd, pads[i], outs[i], vals[i]))
+			return 1;
+	}
+
+	/* The whole bank is loaded, so a gap spanning it sends every change
+	 * in one burst however far apart the pads are. That rewrites the pads
+	 * in between, which is harmless for outputs, but an input pad reads
+	 * back its input level in the value bit and writing that would load
+	 * it into the output latch. Input pads are written with it clear.
+	 */
+	for (i = 0; i < cbar->gpio_count; i++) {
+		int reg = fpga_cache_peek(twifd, cbar->gpio_lo + i);
+
+		if (reg < 0 || (!(reg & 0x1) &&
+		  fpga_cache_rmw(twifd, cbar->gpio_lo + i, 0x2, 0)))
+			return 1;
+	}
+
+	return fpga_cache_flush_range(twifd, cbar->gpio_lo, cbar->gpio_count,
+	  cbar->gpio_count) ? 1 : 0;
+}
+
+void hexdump(uint16_t start, uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if ((i % 16) == 0) {
+			if (i) printf("\n");
+			printf("0x%04X:", start + i);
+		}
+		printf(" %02X", buf[i]);
+	}
+	printf("\n");
 }
 
-void auto485_en(int uart, int baud, char *mode)
+enum {
+	BATCH_PEEK,
+	BATCH_POKE,
+	BATCH_CBAR,
+	BATCH_DAC,
+	BATCH_AUTOTXEN,
+};
+
+struct batch_cmd {
+	int op;
+	int line;
+	uint16_t addr, end;
+	uint8_t vals[64];
+	int nvals;
+	char *pad, *input, *mode;
+	int dac, value, uart, baud;
+};
+
+static int batch_parse(char *buf, int line, struct batch_cmd *cmd)
 {
-	int symsz, i;
-	uint32_t cnt1, cnt2;
+	char *save, *tok, *arg[66];
+	int n = 0;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->line = line;
 
-	if(mode != NULL) {
-		if(mode[0] == '8') symsz = 10;
-		else if(mode[0] == '7') symsz = 9;
-		else if(mode[0] == '6') symsz = 8;
-		else if(mode[0] == '5') symsz = 7;
-		else {
-			fprintf(stderr, "Invalid UART mode setting, %s.\n",
-			  mode);
-			fprintf(stderr, "Forcing 8n1\n");
-			symsz = 10;
-			mode[1] = 'n';
-			mode[2] = '1';
+	for (tok = strtok_r(buf, " \t\r\n", &save); tok != NULL;
+	  tok = strtok_r(NULL, " \t\r\n", &save)) {
+		if (tok[0] == '#') break;
+		if (n == 66)
+			return -1;
+		arg[n++] = tok;
+	}
+	if (n == 0)
+		return 0;
+
+	if (strcmp(arg[0], "peek") == 0 && n == 2) {
+		char *end;
+		cmd->op = BATCH_PEEK;
+		cmd->addr = strtoul(arg[1], &end, 0);
+		cmd->end = cmd->addr;
+		if (*end == '-')
+			cmd->end = strtoul(end + 1, NULL, 0);
+		if (cmd->end < cmd->addr)
+			return -1;
+	} else if (strcmp(arg[0], "poke") == 0 && n >= 3) {
+		int i;
+		cmd->op = BATCH_POKE;
+		cmd->addr = strtoul(arg[1], NULL, 0);
+		for (i = 2; i < n; i++)
+			cmd->vals[cmd->nvals++] = strtoul(arg[i], NULL, 0);
+	} else if (strcmp(arg[0], "cbar") == 0 && (n == 2 || n == 3)) {
+		cmd->op = BATCH_CBAR;
+		cmd->pad = strdup(arg[1]);
+		if (n == 3) {
+			cmd->input = strdup(arg[2]);
+		} else {
+			char *eq = strchr(cmd->pad, '=');
+
+			if (eq == NULL)
+				return -1;
+			*eq = 0;
+			cmd->input = strdup(eq + 1);
 		}
-		if (mode[1] == 'e' || mode[1] == 'o') symsz++;
-		if (mode[2] == '2') symsz++;
-		printf(
-		  "Setting Auto TXEN for %d baud, %d bits per symbol (%s)\n",
-		  baud, symsz, mode);
+	} else if (strcmp(arg[0], "dac") == 0 && n == 3) {
+		cmd->op = BATCH_DAC;
+		cmd->dac = atoi(arg[1]);
+		if (cmd->dac < 0 || cmd->dac > 3)
+			return -1;
+		cmd->value = ((strtoul(arg[2], NULL, 0) & 0xfff) << 1) | 0x1;
+	} else if (strcmp(arg[0], "autotxen") == 0 && n >= 2 && n <= 4) {
+		cmd->op = BATCH_AUTOTXEN;
+		cmd->uart = atoi(arg[1]);
+		if (n > 2) cmd->baud = atoi(arg[2]);
+		if (n > 3) cmd->mode = strdup(arg[3]);
 	} else {
-		/* Assume 8n1 */
-		symsz = 10;
-		printf(
-		  "Setting Auto TXEN for %d baud, 10 bits per symbol (8n1)\n",
-		  baud);
+		return -1;
+	}
+
+	return 1;
+}
+
+static void batch_free(struct batch_cmd *cmd)
+{
+	free(cmd->pad);
+	free(cmd->input);
+	free(cmd->mode);
+}
+
+/* Runs a list of commands, one per line, from path or stdin if path is "-":
+ *
+ *   peek <addr>[-<end>]
+ *   poke <addr> <value> [<value> ...]
+ *   cbar <pad> <input>  (or <pad>=<input>)
+ *   dac <0-3> <value>
+ *   autotxen <uart> [<baud> [<mode>]]
+ *
+ * The whole file is parsed before anything touches the FPGA. cbar, dac and
+ * autotxen writes are staged in the shadow cache and committed in coalesced
+ * bursts, in address order, before the next peek or poke or at the end of
+ * the batch. A poke is written as given, in order, so repeated pokes of one
+ * register all reach the FPGA. Consecutive peeks are served by a single
+ * block read spanning all of them.
+ */
+int run_batch(const char *path)
+{
+	FILE *f;
+	char buf[512];
+	struct batch_cmd *cmds = NULL;
+	int ncmds = 0, line = 0, i, j, r, ret = 0, need_cbar = 0;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		line++;
+		cmds = realloc(cmds, sizeof(*cmds) * (ncmds + 1));
+		assert(cmds != NULL);
+		r = batch_parse(buf, line, &cmds[ncmds]);
+		if (r < 0) {
+			fprintf(stderr, "%s:%d: invalid command\n", path, line);
+			batch_free(&cmds[ncmds]);
+			ret = 1;
+		} else if (r > 0) {
+			if (cmds[ncmds].op == BATCH_CBAR) need_cbar = 1;
+			ncmds++;
+		}
+	}
+	if (f != stdin)
+		fclose(f);
+	if (ret)
+		goto out;
+
+	if (need_cbar && cbar_load()) {
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < ncmds; ) {
+		struct batch_cmd *cmd = &cmds[i];
+		int lo, hi;
+
+		if (cmd->op != BATCH_PEEK) {
+			switch (cmd->op) {
+			case BATCH_POKE:
+				/* Raw pokes bypass the shadow so strobes and
+				 * clear-on-write registers see every write,
+				 * after anything staged before them. The
+				 * shadow is reloaded from the FPGA on the
+				 * next access to the poked range.
+				 */
+				ret |= fpga_cache_flush(twifd);
+				ret |= fpoke_block(twifd, cmd->addr,
+				  cmd->vals, cmd->nvals);
+				fpga_cache_invalidate(cmd->addr, cmd->nvals);
+				break;
+			case BATCH_CBAR:
+				if (cbar_assign(cmd->pad, cmd->input))
+					ret = 1;
+				break;
+			case BATCH_DAC:
+				dac_set(cmd->dac, cmd->value >> 1);
+				break;
+			case BATCH_AUTOTXEN:
+				if (auto485_en(cmd->uart, cmd->baud,
+				  cmd->mode, NULL))
+					ret = 1;
+				break;
+			}
+			i++;
+			continue;
+		}
+
+		/* Gather the run of consecutive peeks */
+		ret |= fpga_cache_flush(twifd);
+		lo = cmd->addr;
+		hi = cmd->end;
+		for (j = i; j < ncmds && cmds[j].op == BATCH_PEEK; j++) {
+			if (cmds[j].addr < lo) lo = cmds[j].addr;
+			if (cmds[j].end > hi) hi = cmds[j].end;
+		}
+
+		if (hi < FPGA_CACHE_SIZE) {
+			if (fpga_cache_load(twifd, lo, (hi - lo) + 1)) {
+				ret = 1;
+				goto out;
+			}
+		}
+
+		for (; i < j; i++) {
+			int len = (cmds[i].end - cmds[i].addr) + 1;
+			uint8_t *data = malloc(len);
+
+			assert(data != NULL);
+			if (hi < FPGA_CACHE_SIZE) {
+				for (r = 0; r < len; r++) {
+					int v = fpga_cache_peek(twifd,
+					  cmds[i].addr + r);
+
+					if (v < 0) {
+						free(data);
+						ret = 1;
+						goto out;
+					}
+					data[r] = v;
+				}
+			} else if (fpeek_block(twifd, cmds[i].addr, data,
+			  len)) {
+				free(data);
+				ret = 1;
+				goto out;
+			}
+
+			if (len == 1)
+				printf("0x%X\n", data[0]);
+			else
+				hexdump(cmds[i].addr, data, len);
+			free(data);
+		}
+	}
+
+	ret |= fpga_cache_flush(twifd);
+
+out:
+	for (i = 0; i < ncmds; i++)
+		batch_free(&cmds[i]);
+	free(cmds);
+
+	return ret ? 1 : 0;
+}
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
+/* Adds ms to an absolute CLOCK_MONOTONIC deadline */
+static void ts_add_ms(struct timespec *ts, int ms)
+{
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+	ts->tv_sec += ms / 1000 + ts->tv_nsec / 1000000000L;
+	ts->tv_nsec %= 1000000000L;
+}
+
+struct watch_range {
+	uint16_t start, end;
+};
+
+/* Longest block read, i2c_write()'s limit and well inside what an I2C_RDWR
+ * message and the tshwctld chunking handle.
+ */
+#define WATCH_MAX_LEN	256
+
+static int cmp_range(const void *a, const void *b)
+{
+	return ((const struct watch_range *)a)->start -
+	  ((const struct watch_range *)b)->start;
+}
+
+/* Samples the registers in spec, "ADDR[-END],...", every interval_ms until
+ * interrupted. The first sample prints every register, later ones only the
+ * registers that changed, each line prefixed with the wall clock time.
+ * Ranges closer together than a transaction's own overhead are merged and
+ * read with one block transfer.
+ */
+int run_watch(char *spec, int interval_ms)
+{
+	struct watch_range ranges[64];
+	unsigned long a, b;
+	int nranges = 0, i, j, first = 1;
+	static uint8_t cur[0x10000], prev[0x10000], want[0x10000];
+	char *tok, *save, *end;
+	struct timespec next;
+
+	for (tok = strtok_r(spec, ",", &save); tok != NULL;
+	  tok = strtok_r(NULL, ",", &save)) {
+		if (nranges == 64) {
+			fprintf(stderr, "Too many watch ranges\n");
+			return 1;
+		}
+		a = strtoul(tok, &end, 0);
+		b = a;
+		if (end != tok && *end == '-') {
+			char *p = end + 1;
+
+			b = strtoul(p, &end, 0);
+			if (end == p)
+				end = tok;
+		}
+		if (end == tok || *end != 0 || a > 0xFFFF || b > 0xFFFF ||
+		  b < a || (b - a) + 1 > WATCH_MAX_LEN) {
+			fprintf(stderr, "Invalid watch range %s, at most %d "
+			  "registers from 0x0-0xFFFF\n", tok, WATCH_MAX_LEN);
+			return 1;
+		}
+		ranges[nranges].start = a;
+		ranges[nranges].end = b;
+		for (j = ranges[nranges].start; j <= ranges[nranges].end; j++)
+			want[j] = 1;
+		nranges++;
 	}
+	if (nranges == 0)
+		return 1;
+
+	qsort(ranges, nranges, sizeof(ranges[0]), cmp_range);
+	for (i = 0, j = 1; j < nranges; j++) {
+		if (ranges[j].start <= ranges[i].end + 4 &&
+		  ranges[j].end - ranges[i].start < WATCH_MAX_LEN) {
+			if (ranges[j].end > ranges[i].end)
+				ranges[i].end = ranges[j].end;
+		} else {
+			ranges[++i] = ranges[j];
+		}
+	}
+	nranges = i + 1;
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!stop) {
+		struct timespec now;
+		int changed = 0;
 
-	autotx_bitstoclks(symsz, baud, &cnt1, &cnt2);
-	i = (0x36 + (uart * 6));
-	fpoke8(twifd, i++, (uint8_t)((cnt1 & 0xff0000) >> 16));
-	fpoke8(twifd, i++, (uint8_t)((cnt1 & 0xff00) >> 8));
-	fpoke8(twifd, i++, (uint8_t)(cnt1 & 0xff));
-	fpoke8(twifd, i++, (uint8_t)((cnt2 & 0xff0000) >> 16));
-	fpoke8(twifd, i++, (uint8_t)((cnt2 & 0xff00) >> 8));
-	fpoke8(twifd, i++, (uint8_t)(cnt2 & 0xff));
+		for (i = 0; i < nranges; i++) {
+			if (fpeek_block(twifd, ranges[i].start,
+			  &cur[ranges[i].start],
+			  (ranges[i].end - ranges[i].start) + 1))
+				return 1;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (i = 0; i < nranges; i++) {
+			for (j = ranges[i].start; j <= ranges[i].end; j++) {
+				if (!want[j] || (!first && cur[j] == prev[j]))
+					continue;
+				if (!changed++)
+					printf("%ld.%06ld", (long)now.tv_sec,
+					  now.tv_nsec / 1000);
+				printf(" 0x%X=0x%X", j, cur[j]);
+				prev[j] = cur[j];
+			}
+		}
+		if (changed) {
+			printf("\n");
+			fflush(stdout);
+		}
+		first = 0;
+
+		ts_add_ms(&next, interval_ms);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+		  NULL) == EINTR && !stop);
+	}
 
+	return 0;
 }
 
+/* Follows the tty's line settings, reprogramming the TXEN counters of uart
+ * whenever the baud rate or mode changes. termios has no change
+ * notification, but tcgetattr() is a local call, so polling costs no bus
+ * traffic; only a change is written to the FPGA.
+ */
+int run_auto485_watch(int uart, const char *tty, int interval_ms)
+{
+	struct timespec next;
+	char mode[4], last_mode[4] = "";
+	int baud, last_baud = 0, fd, ret = 0;
+
+	tty = uart_tty(uart, tty);
+	fd = uart_open(tty);
+	if (fd == -1)
+		return 1;
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!stop) {
+		if (uart_get_config(fd, tty, &baud, mode)) {
+			ret = 1;
+			break;
+		}
+		if (baud != last_baud || strcmp(mode, last_mode)) {
+			if (auto485_en(uart, baud, mode, tty) ||
+			  fpga_cache_flush(twifd)) {
+				ret = 1;
+				break;
+			}
+			fflush(stdout);
+			last_baud = baud;
+			strcpy(last_mode, mode);
+		}
+
+		ts_add_ms(&next, interval_ms);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+		  NULL) == EINTR && !stop);
+	}
+	close(fd);
+
+	return ret;
+}
+
+static uint64_t mono_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+/* Opens path for writing, through gzip if it ends in .gz */
+static FILE *open_output(const char *path, pid_t *gzpid)
+{
+	int fd, pipefd[2];
+	size_t len = strlen(path);
+	FILE *f;
+
+	*gzpid = 0;
+	if (strcmp(path, "-") == 0)
+		return stdout;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(path);
+		return NULL;
+	}
+	if (len < 3 || strcmp(path + len - 3, ".gz") != 0)
+		return fdopen(fd, "w");
+
+	if (pipe(pipefd) == -1) {
+		perror("pipe");
+		close(fd);
+		return NULL;
+	}
+	*gzpid = fork();
+	if (*gzpid == 0) {
+		dup2(pipefd[0], 0);
+		dup2(fd, 1);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		close(fd);
+		execlp("gzip", "gzip", "-c", NULL);
+		perror("gzip");
+		_exit(1);
+	}
+	close(pipefd[0]);
+	close(fd);
+	if (*gzpid == -1) {
+		perror("fork");
+		close(pipefd[1]);
+		return NULL;
+	}
+	f = fdopen(pipefd[1], "w");
+
+	return f;
+}
+
+/* Closes an open_output() file and waits for its gzip, if any. Returns -1
+ * if the output could not be written or gzip failed.
+ */
+static int close_output(FILE *f, const char *path, pid_t gzpid)
+{
+	int ret = 0, status;
+
+	if ((f != stdout ? fclose(f) : fflush(f)) == EOF) {
+		perror(path);
+		ret = -1;
+	}
+	if (gzpid > 0) {
+		if (waitpid(gzpid, &status, 0) == -1 || !WIFEXITED(status) ||
+		  WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: gzip failed\n", path);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/* Captures the FPGA GPIO pad values and directions to a VCD file for
+ * GTKWave. Every sample is one block read of the whole bank; only changes
+ * are written, which is all VCD records anyway. With interval_ms of 0 the
+ * bus is sampled back to back, otherwise a sample that starts a whole
+ * interval or more late counts the skipped intervals as dropped. Runs for
+ * nsamples, or until interrupted if 0, then reports the achieved rate.
+ */
+int run_capture(const char *path, int interval_ms, long nsamples)
+{
+	FILE *f;
+	pid_t gzpid;
+	uint32_t dir, val, pdir = 0, pval = 0;
+	uint64_t start, now, next, late, max_late = 0, dropped = 0;
+	uint64_t period = (uint64_t)interval_ms * 1000;
+	long n;
+	int i, ret = 0;
+
+	if (cbar->gpio_count == 0) {
+		fprintf(stderr, "No FPGA GPIO pads on TS-%X\n", cbar->model);
+		return 1;
+	}
+
+	f = open_output(path, &gzpid);
+	if (f == NULL)
+		return 1;
+
+	fprintf(f, "$version tshwctl %s $end\n", GITCOMMIT);
+	fprintf(f, "$timescale 1us $end\n");
+	fprintf(f, "$scope module fpga $end\n");
+	for (i = 0; i < cbar->gpio_count; i++) {
+		fprintf(f, "$var wire 1 %c %s $end\n", '!' + i,
+		  cbar->outputs[i].name);
+		fprintf(f, "$var wire 1 %c %s_dir $end\n", '!' + 32 + i,
+		  cbar->outputs[i].name);
+	}
+	fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	start = next = mono_us();
+	for (n = 0; !stop && (nsamples == 0 || n < nsamples); n++) {
+		if (period) {
+			now = mono_us();
+			if (now < next) {
+				struct timespec ts;
+				ts.tv_sec = (next - now) / 1000000;
+				ts.tv_nsec = ((next - now) % 1000000) * 1000;
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		now = mono_us();
+		if (cbar_gpio_read(cbar, twifd, &dir, &val)) {
+			fprintf(stderr, "Unable to read the GPIO pads\n");
+			ret = 1;
+			break;
+		}
+
+		if (period) {
+			late = now > next ? now - next : 0;
+			if (late > max_late) max_late = late;
+			if (late >= period) {
+				dropped += late / period;
+				next += (late / period) * period;
+			}
+			next += period;
+		}
+
+		if (n && dir == pdir && val == pval)
+			continue;
+		fprintf(f, "#%llu\n", (unsigned long long)(now - start));
+		for (i = 0; i < cbar->gpio_count; i++) {
+			if (n == 0 || ((val ^ pval) >> i) & 1)
+				fprintf(f, "%d%c\n", (val >> i) & 1, '!' + i);
+			if (n == 0 || ((dir ^ pdir) >> i) & 1)
+				fprintf(f, "%d%c\n", (dir >> i) & 1,
+				  '!' + 32 + i);
+		}
+		pdir = dir;
+		pval = val;
+	}
+	now = mono_us();
+	fprintf(f, "#%llu\n", (unsigned long long)(now - start));
+	if (close_output(f, path, gzpid))
+		ret = 1;
+
+	fprintf(stderr, "samples=%ld\n", n);
+	fprintf(stderr, "duration_us=%llu\n",
+	  (unsigned long long)(now - start));
+	fprintf(stderr, "sample_rate=%.1f\n",
+	  now > start ? n / ((now - start) / 1e6) : 0.0);
+	if (period) {
+		fprintf(stderr, "dropped_intervals=%llu\n",
+		  (unsigned long long)dropped);
+		fprintf(stderr, "max_late_us=%llu\n",
+		  (unsigned long long)max_late);
+	}
+
+	return ret;
+}
+
+/* Counts rising edges on the CPU GPIO lines in spec, printing a CSV row per
+ * line every interval_ms: the total, the frequency over the interval, from
+ * the last two edges, and since the first edge. Stops after nreports, or
+ * when interrupted if 0, and summarizes each line to stderr.
+ */
+int run_count(const char *spec, int interval_ms, long nreports)
+{
+	struct pulse_counter pc;
+	uint64_t start, next, now = 0;
+	long n = 0;
+	int i, ret = 0;
+
+	if (pulse_open(&pc, spec))
+		return 1;
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	printf("time_s,line,count,hz,inst_hz,avg_hz\n");
+	start = next = mono_us();
+	while (!stop && (nreports == 0 || n < nreports)) {
+		next += (uint64_t)interval_ms * 1000;
+		while (!stop && !ret && (now = mono_us()) < next) {
+			if (pulse_wait(&pc, ((next - now) + 999) / 1000) < 0)
+				ret = 1;
+		}
+		if (stop || ret)
+			break;
+
+		for (i = 0; i < pc.nlines; i++) {
+			struct pulse_line *pl = &pc.lines[i];
+			double hz = pulse_mark(pl);
+
+			printf("%.3f,%s,%llu,%.3f,%.3f,%.3f\n",
+			  (now - start) / 1e6, pl->name,
+			  (unsigned long long)pl->count, hz, pl->inst_hz,
+			  pulse_avg_hz(pl));
+		}
+		fflush(stdout);
+		n++;
+	}
+
+	for (i = 0; i < pc.nlines; i++) {
+		struct pulse_line *pl = &pc.lines[i];
+
+		fprintf(stderr, "line=%s count=%llu avg_hz=%.3f "
+		  "full_reads=%llu\n", pl->name,
+		  (unsigned long long)pl->count, pulse_avg_hz(pl),
+		  (unsigned long long)pl->full_reads);
+		if (pl->full_reads)
+			fprintf(stderr, "%s: event queue was full, edges "
+			  "may have been missed\n", pl->name);
+	}
+	pulse_close(&pc);
+
+	return ret;
+}
+
+/* Waits up to timeout_us for an edge on a line requested for events and
+ * consumes it. Returns 1 for an edge, 0 on timeout, -1 on error or signal.
+ */
+static int wait_edge(struct gpiod_line *line, uint64_t timeout_us,
+  struct gpiod_line_event *ev)
+{
+	struct timespec ts;
+	int ret;
+
+	ts.tv_sec = timeout_us / 1000000;
+	ts.tv_nsec = (timeout_us % 1000000) * 1000;
+	ret = gpiod_line_event_wait(line, &ts);
+	if (ret == 1 && gpiod_line_event_read(line, ev))
+		ret = -1;
+
+	return ret;
+}
+
+/* Enables the 3.3 V test and powers the MODBUS port with 24 V once the fault
+ * line has been low, with no edges, for settle_us. If that does not happen
+ * within timeout_ms the port is left off. Returns 1 if powered on.
+ */
+int modbus_poweron(struct gpiod_line *l3vn, struct gpiod_line *lfault,
+  struct gpiod_line *l24v, int settle_us, int timeout_ms)
+{
+	struct gpiod_line_event ev;
+	uint64_t now, low_since, deadline, until;
+	int low, ret = 0;
+
+	gpiod_line_set_value(l3vn, 0);
+	now = mono_us();
+	deadline = now + ((uint64_t)timeout_ms * 1000);
+	low = !gpiod_line_get_value(lfault);
+	low_since = now;
+
+	for (;;) {
+		now = mono_us();
+		if (low && now - low_since >= (uint64_t)settle_us) {
+			ret = 1;
+			break;
+		}
+		if (now >= deadline)
+			break;
+
+		until = low ? low_since + settle_us : deadline;
+		if (until > deadline)
+			until = deadline;
+		switch (wait_edge(lfault, until - now, &ev)) {
+		case 1:
+			low = !gpiod_line_get_value(lfault);
+			low_since = mono_us();
+			break;
+		case -1:
+			gpiod_line_set_value(l3vn, 1);
+			return 0;
+		}
+	}
+
+	gpiod_line_set_value(l3vn, 1);
+	if (ret)
+		gpiod_line_set_value(l24v, 1);
+
+	return ret;
+}
+
+/* Holds the MODBUS lines and sleeps on fault line edges, cutting 24 V as
+ * soon as one shows a fault. The process is locked in memory and, if
+ * permitted, runs SCHED_FIFO, so the cut is one wakeup and one ioctl after
+ * the edge interrupt. Returns 1 after a fault, or with 24 V cut if the fault
+ * line can no longer be watched, 0 if interrupted.
+ */
+int modbus_monitor(struct gpiod_line *lfault, struct gpiod_line *l24v)
+{
+	struct gpiod_line_event ev;
+	struct sched_param sp = { .sched_priority = 50 };
+	struct timespec now;
+	int64_t lat;
+
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+	sched_setscheduler(0, SCHED_FIFO, &sp);
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	while (!stop) {
+		if (gpiod_line_get_value(lfault)) {
+			gpiod_line_set_value(l24v, 0);
+			printf("modbusfault=1\n");
+			return 1;
+		}
+		switch (wait_edge(lfault, 1000000, &ev)) {
+		case 0:
+			continue;
+		case -1:
+			if (stop)
+				return 0;
+			perror("gpiod_line_event_wait");
+			gpiod_line_set_value(l24v, 0);
+			return 1;
+		}
+		if (ev.event_type != GPIOD_LINE_EVENT_RISING_EDGE)
+			continue;
+
+		gpiod_line_set_value(l24v, 0);
+		/* Older kernels stamp events with CLOCK_REALTIME */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - ev.ts.tv_sec > 1 ||
+		  ev.ts.tv_sec - now.tv_sec > 1)
+			clock_gettime(CLOCK_REALTIME, &now);
+		lat = ((int64_t)(now.tv_sec - ev.ts.tv_sec) * 1000000000LL) +
+		  (now.tv_nsec - ev.ts.tv_nsec);
+		printf("modbusfault=1\n");
+		fprintf(stderr, "fault_to_off_us=%.1f\n", lat / 1000.0);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Parses one sample line for run_dac_stream(): up to four DAC values
+ * separated by commas or whitespace, or "-" to leave that DAC as it is.
+ * Returns the number of columns, 0 for blank or comment lines, -1 on error.
+ */
+static int dac_parse_line(char *line, int *vals)
+{
+	char *tok, *end, *save;
+	int n = 0;
+
+	line[strcspn(line, "#\n")] = '\0';
+	for (tok = strtok_r(line, ", \t", &save); tok;
+	  tok = strtok_r(NULL, ", \t", &save)) {
+		if (n == 4)
+			return -1;
+		if (strcmp(tok, "-") == 0) {
+			vals[n++] = -1;
+			continue;
+		}
+		vals[n] = strtoul(tok, &end, 0);
+		if (*end || vals[n] > 0xfff)
+			return -1;
+		n++;
+	}
+
+	return n;
+}
+
+/* Streams DAC samples from path ("-" for stdin) at rate_hz, paced by a
+ * timerfd. Only the DAC bytes that change are sent, but all of a line's
+ * changes go out in one burst so the DACs update together. A line is
+ * parsed before waiting for its deadline so that only the write itself is
+ * timed. Expirations beyond one per wakeup are missed deadlines; the sample
+ * is written late, not dropped.
+ */
+int run_dac_stream(const char *path, int rate_hz)
+{
+	FILE *f;
+	char line[256];
+	int vals[4], i, n, tfd, lineno = 0;
+	uint64_t exp, missed = 0, period_ns, t, prev = 0;
+	uint64_t min_ns = UINT64_MAX, max_ns = 0, sum_ns = 0;
+	uint64_t max_jit = 0, sum_jit = 0, max_wr = 0;
+	long samples = 0;
+	struct itimerspec its;
+	struct timespec ts;
+	int ret = 0;
+
+	if (strcmp(path, "-") == 0) {
+		f = stdin;
+	} else {
+		f = fopen(path, "r");
+		if (f == NULL) {
+			perror(path);
+			return 1;
+		}
+	}
+
+	if (dac_init(twifd)) {
+		fprintf(stderr, "Failed to read DAC registers\n");
+		ret = 1;
+		goto out;
+	}
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd == -1) {
+		perror("timerfd_create");
+		ret = 1;
+		goto out;
+	}
+	period_ns = 1000000000ULL / rate_hz;
+	its.it_interval.tv_sec = period_ns / 1000000000ULL;
+	its.it_interval.tv_nsec = period_ns % 1000000000ULL;
+	its.it_value = its.it_interval;
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+
+	while (!stop && fgets(line, sizeof(line), f)) {
+		lineno++;
+		n = dac_parse_line(line, vals);
+		if (n == 0)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "%s:%d: Bad DAC sample\n", path,
+			  lineno);
+			ret = 1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (vals[i] != -1)
+				dac_set(i, vals[i]);
+		}
+
+		if (samples == 0) {
+			timerfd_settime(tfd, 0, &its, NULL);
+		} else if (read(tfd, &exp, sizeof(exp)) != sizeof(exp)) {
+			if (!stop)
+				perror("timerfd");
+			break;
+		} else {
+			missed += exp - 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+		if (samples) {
+			uint64_t d = t - prev;
+			uint64_t jit = d > period_ns ? d - period_ns :
+			  period_ns - d;
+
+			if (d < min_ns) min_ns = d;
+			if (d > max_ns) max_ns = d;
+			sum_ns += d;
+			if (jit > max_jit) max_jit = jit;
+			sum_jit += jit;
+		}
+		prev = t;
+
+		if (dac_flush(twifd)) {
+			fprintf(stderr, "DAC write failed\n");
+			ret = 1;
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec - t;
+		if (t > max_wr) max_wr = t;
+		samples++;
+	}
+	close(tfd);
+
+	fprintf(stderr, "samples=%ld\n", samples);
+	fprintf(stderr, "missed_deadlines=%llu\n",
+	  (unsigned long long)missed);
+	if (samples > 1) {
+		fprintf(stderr, "period_us=%.1f\n", period_ns / 1000.0);
+		fprintf(stderr, "period_min_us=%.1f\n", min_ns / 1000.0);
+		fprintf(stderr, "period_max_us=%.1f\n", max_ns / 1000.0);
+		fprintf(stderr, "period_avg_us=%.1f\n",
+		  sum_ns / 1000.0 / (samples - 1));
+		fprintf(stderr, "jitter_avg_us=%.1f\n",
+		  sum_jit / 1000.0 / (samples - 1));
+		fprintf(stderr, "jitter_max_us=%.1f\n", max_jit / 1000.0);
+	}
+	fprintf(stderr, "write_max_us=%.1f\n", max_wr / 1000.0);
+
+out:
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
+
+/* Adds 10 die temperature readings from the mxs-lradc IIO driver to sum.
+ * Its in_temp_raw is the channel 9 less channel 8 difference the register
+ * path takes, so the result goes through the same conversion.
+ */
+static int cputemp_iio(signed int *sum)
+{
+	struct iio_dev d;
+	long raw;
+	int x;
+
+	if (iio_find(&d, "mxs-lradc")) {
+		fprintf(stderr, "No mxs-lradc IIO device in %s\n", iio_root());
+		return -1;
+	}
+	for (x = 0; x < 10; x++) {
+		if (iio_read_long(&d, "in_temp_raw", &raw)) {
+			fprintf(stderr, "%s/in_temp_raw: read failed\n",
+			  d.path);
+			return -1;
+		}
+		*sum += raw;
+	}
+
+	return 0;
+}
 
 void usage(char **argv) {
 	fprintf(stderr,
@@ -100,27 +1401,82 @@ void usage(char **argv) {
 	  "\n"
 	  "  -i, --info             Display board info\n"
 	  "  -m, --addr <address>   Sets up the address for a peek/poke\n"
+	  "                           <start>-<end> sets a range for a peek\n"
 	  "  -v, --poke <value>     Writes the value to the specified address\n"
-	  "  -t, --peek             Reads from the specified address\n"
+	  "  -t, --peek             Reads from the specified address, or\n"
+	  "                           hexdumps the specified range\n"
 	  "  -o, --mode <8n1>       Used with -a, sets mode like '8n1', '7e2'\n"
 	  "  -x, --baud <speed>     Used with -a, sets baud rate for auto485\n"
 	  "  -a, --autotxen <uart>  Enables autotxen for supported CPU UARTs\n"
 	  "                           Uses baud/mode if set or reads the\n"
 	  "                           current configuration of that uart\n"
+	  "  -R, --txen-guard <ns>  Hold TXEN <ns> past the last stop bit\n"
+	  "  -K, --txen-check       With -a, print and simulate the TXEN timing\n"
+	  "                           rather than programming it\n"
+	  "  -N, --count <lines>    Count rising edges on CPU GPIO lines, by\n"
+	  "                           name or <chip>:<offset>, comma separated,\n"
+	  "                           a CSV row per line every --interval ms\n"
+	  "                           until --samples rows or interrupted\n"
+	  "  -u, --tty <dev>        Read the uart configuration from <dev>,\n"
+	  "                           default /dev/ttyAPP<uart>\n"
+	  "  -W, --autotxen-watch   Keep running, reprogramming autotxen when\n"
+	  "                           the tty's baud or mode changes; the tty\n"
+	  "                           is checked every --interval ms\n"
 	  "  -c, --dump             Prints out the crossbar configuration\n"
 	  "  -g, --get              Print crossbar for use in eval\n"
 	  "  -s, --set              Read environment for crossbar changes\n"
        	  "  -q, --showall          Print all possible FPGA crossbar I/O\n"
+	  "  -G, --gpio-get         Print FPGA GPIO pad values and directions\n"
+	  "  -O, --gpio-set <pads>  Set FPGA GPIO pads, PAD=0|1|in,...\n"
+	  "  -P, --save-profile <f> Save the crossbar registers to <f>\n"
+	  "  -A, --apply-profile <f> Apply saved crossbar registers, only\n"
+	  "                           writing pads that change\n"
 	  "  -e, --cputemp          Print CPU internal temperature\n"
 	  "  -1, --modbuspoweron    Enable VIN to MODBUS port\n"
 	  "  -Z, --modbuspoweroff   Gate off VIN to MODBUS port\n"
+	  "  -E, --modbus-settle <us> Fault line must be low this long before\n"
+	  "                           power on, default 1000\n"
+	  "  -L, --modbus-timeout <ms> Give up on power on after <ms>,\n"
+	  "                           default 10\n"
+	  "  -M, --modbus-monitor   After power on, keep running and gate off\n"
+	  "                           VIN on a MODBUS fault\n"
 	  "  -p, --getmac           Display ethernet MAC address\n"
 	  "  -l, --setmac=MAC       Set ethernet MAC address\n"
 	  "  -b, --dac0 <PWMval>    Set DAC0 output to <PWMval>\n"
 	  "  -d, --dac1 <PWMval>    Set DAC1 output to <PWMval>\n"
 	  "  -f, --dac2 <PWMval>    Set DAC2 output to <PWMval>\n"
 	  "  -j, --dac3 <PWMval>    Set DAC3 output to <PWMval>\n"
+	  "  -y, --slew <n>         Ramp --dac0-3 to their values at <n> counts\n"
+	  "                           per second, in steps at --rate\n"
+	  "  -D, --dac-stream <file> Write DAC samples from <file> ('-' for\n"
+	  "                           stdin), one line per update, up to four\n"
+	  "                           12-bit values for DAC0-DAC3, '-' to skip\n"
+	  "  -r, --rate <hz>        Update rate for --dac-stream or --slew,\n"
+	  "                           default 100\n"
+	  "  -B, --batch <file>     Run peek/poke/cbar/dac/autotxen commands\n"
+	  "                           from <file>, or stdin if <file> is -\n"
+	  "  -w, --watch <ranges>   Print registers in ADDR[-END],... as they\n"
+	  "                           change, until interrupted\n"
+	  "  -I, --interval <ms>    Sample period for --watch, default 1000, or\n"
+	  "                           --capture, default or 0 as fast as\n"
+	  "                           possible\n"
+	  "  -C, --capture <file>   Record FPGA GPIO pads to a VCD <file>,\n"
+	  "                           gzip compressed if it ends in .gz\n"
+	  "  -n, --samples <n>      Stop --capture after <n> samples\n"
+	  "  -T, --trace            Print every bus transaction to stderr\n"
+	  "  -S, --stats            Print bus transaction and ADC wait totals\n"
+	  "                           to stderr\n"
+	  "  -k, --backend <spec>   FPGA access backend, one of i2c[:<dev>],\n"
+	  "                           tshwctld[:<socket>], sim, file:<path>\n"
 	  "  -h, --help             This message\n"
+	  "\n"
+	  "FPGA access goes through tshwctld when it is running, set\n"
+	  "TSHWCTLD_SOCKET to use a socket other than " TSHWCTLD_SOCKET "\n"
+	  "FPGA_BACKEND selects a backend like --backend. The sim and file\n"
+	  "backends take FPGA_SIM_BUS_HZ, FPGA_SIM_OVERHEAD_US and\n"
+	  "FPGA_SIM_MODEL to shape the simulated bus\n"
+	  "ADC_BACKEND=iio reads --cputemp through the IIO driver, under\n"
+	  "IIO_ROOT if set, rather than the LRADC registers\n"
 	  "\n",
 	  copyright, argv[0]
 	);
@@ -129,7 +1485,7 @@ void usage(char **argv) {
 int main(int argc, char **argv)
 {
 	int c, i;
-	uint16_t addr = 0x0;
+	uint16_t addr = 0x0, addr_end = 0x0;
 	int opt_addr = 0;
 	int opt_poke = 0, opt_peek = 0, opt_auto485 = -1;
 	int opt_set = 0, opt_get = 0, opt_dump = 0;
@@ -138,11 +1494,28 @@ int main(int argc, char **argv)
 	int opt_dac0 = 0, opt_dac1 = 0, opt_dac2 = 0, opt_dac3 = 0;
 	char *opt_mac = NULL;
 	int baud = 0;
-	int model;
+	int model = 0;
 	uint8_t pokeval = 0;
 	char *uartmode = 0;
-	struct cbarpin *cbar_inputs, *cbar_outputs;
-	int cbar_size, cbar_mask;
+	char *opt_batch = NULL;
+	char *opt_backend = NULL;
+	int opt_showall = 0, opt_trace = 0, opt_stats = 0;
+	char *opt_watch = NULL;
+	char *opt_save_profile = NULL, *opt_apply_profile = NULL;
+	char *opt_gpio_set = NULL;
+	int opt_gpio_get = 0;
+	int opt_interval = -1;
+	char *opt_capture = NULL;
+	char *opt_dac_stream = NULL;
+	int opt_rate = 100;
+	int opt_slew = 0;
+	int opt_auto485_watch = 0;
+	char *opt_tty = NULL;
+	char *opt_count = NULL;
+	int opt_modbus_settle = 1000, opt_modbus_timeout = 10;
+	int opt_modbus_monitor = 0;
+	int ret = 0;
+	long opt_samples = 0;
 	struct gpiod_chip *chip = NULL;
 	struct gpiod_line *line_bootmode = NULL;
 	struct gpiod_line *line_modbus_3vn = NULL;
@@ -159,20 +1532,43 @@ int main(int argc, char **argv)
 		{ "baud", 1, 0, 'x' },
 		{ "mode", 1, 0, 'o' },
 		{ "autotxen", 1, 0, 'a' },
+		{ "autotxen-watch", 0, 0, 'W' },
+		{ "tty", 1, 0, 'u' },
+		{ "count", 1, 0, 'N' },
+		{ "txen-guard", 1, 0, 'R' },
+		{ "txen-check", 0, 0, 'K' },
 		{ "get", 0, 0, 'g' },
 		{ "set", 0, 0, 's' },
 		{ "dump", 0, 0, 'c' },
 		{ "showall", 0, 0, 'q' },
+		{ "gpio-get", 0, 0, 'G' },
+		{ "gpio-set", 1, 0, 'O' },
+		{ "save-profile", 1, 0, 'P' },
+		{ "apply-profile", 1, 0, 'A' },
 		{ "getmac", 0, 0, 'p' },
 		{ "setmac", 1, 0, 'l' },
 		{ "cputemp", 0, 0, 'e' },
 		{ "modbuspoweron", 0, 0, '1' },
 		{ "modbuspoweroff", 0, 0, 'Z' },
+		{ "modbus-settle", 1, 0, 'E' },
+		{ "modbus-timeout", 1, 0, 'L' },
+		{ "modbus-monitor", 0, 0, 'M' },
 		{ "info", 0, 0, 'i' },
 		{ "dac0", 1, 0, 'b' },
 		{ "dac1", 1, 0, 'd' },
 		{ "dac2", 1, 0, 'f' },
 		{ "dac3", 1, 0, 'j' },
+		{ "batch", 1, 0, 'B' },
+		{ "backend", 1, 0, 'k' },
+		{ "trace", 0, 0, 'T' },
+		{ "watch", 1, 0, 'w' },
+		{ "interval", 1, 0, 'I' },
+		{ "capture", 1, 0, 'C' },
+		{ "dac-stream", 1, 0, 'D' },
+		{ "rate", 1, 0, 'r' },
+		{ "slew", 1, 0, 'y' },
+		{ "samples", 1, 0, 'n' },
+		{ "stats", 0, 0, 'S' },
 		{ "help", 0, 0, 'h' },
 		{ 0, 0, 0, 0 }
 	};
@@ -182,29 +1578,7 @@ int main(int argc, char **argv)
 		return(1);
 	}
 
-	model = get_model();
-	if(model == 0x7680) {
-		cbar_inputs = ts7680_inputs;
-		cbar_outputs = ts7680_outputs;
-		cbar_size = 6;
-		cbar_mask = 3;
-	} else if(model == 0x7682) {
-		cbar_inputs = ts7682_inputs;
-		cbar_outputs = ts7682_outputs;
-		cbar_size = 6;
-		cbar_mask = 3;
-	} else {
-		fprintf(stderr, "Unsupported model TS-%X\n", model);
-		return 1;
-	}
-
-	chip = gpiod_chip_open_by_number(1);
-	if (chip == NULL) {
-		fprintf(stderr, "Unable to open GPIO chip\n");
-		return 1;
-	}
-
-	while((c = getopt_long(argc, argv, "+m:v:o:x:ta:cgsqhipl:e1Zb:d:f:j:",
+	while((c = getopt_long(argc, argv, "+m:v:o:x:ta:cgsqhipl:e1Zb:d:f:j:B:k:TSw:I:P:A:GO:C:n:D:r:y:Wu:R:KN:E:L:M",
 	  long_options, NULL)) != -1) {
 		switch(c) {
 
@@ -222,10 +1596,23 @@ int main(int argc, char **argv)
 			opt_modbuspoweroff = 1;
 			opt_modbuspoweron = 0;
 			break;
-		case 'm':
+		case 'm': {
+			unsigned long long lo, hi;
+			char *end;
 			opt_addr = 1;
-			addr = strtoull(optarg, NULL, 0);
+			lo = hi = strtoull(optarg, &end, 0);
+			if (*end == '-')
+				hi = strtoull(end + 1, NULL, 0);
+			if (hi > 0xffff || hi < lo ||
+			  hi - lo + 1 > FPGA_MAX_READ) {
+				fprintf(stderr, "Invalid address range %s\n",
+				  optarg);
+				return 1;
+			}
+			addr = lo;
+			addr_end = hi;
 			break;
+		}
 		case 'v':
 			opt_poke = 1;
 			pokeval = strtoull(optarg, NULL, 0);
@@ -242,6 +1629,30 @@ int main(int argc, char **argv)
 		case 'a':
 			opt_auto485 = atoi(optarg);
 			break;
+		case 'W':
+			opt_auto485_watch = 1;
+			break;
+		case 'u':
+			opt_tty = strdup(optarg);
+			break;
+		case 'E':
+			opt_modbus_settle = atoi(optarg);
+			break;
+		case 'L':
+			opt_modbus_timeout = atoi(optarg);
+			break;
+		case 'M':
+			opt_modbus_monitor = 1;
+			break;
+		case 'N':
+			opt_count = strdup(optarg);
+			break;
+		case 'R':
+			txen_guard_ns = atoi(optarg);
+			break;
+		case 'K':
+			txen_check = 1;
+			break;
 		case 'g':
 			opt_get = 1;
 			break;
@@ -252,15 +1663,43 @@ int main(int argc, char **argv)
 			opt_dump = 1;
 			break;
 		case 'q':
-			printf("FPGA Outputs:\n");
-			for (i = 0; cbar_outputs[i].name != 0; i++) {
-				printf("%s\n", cbar_outputs[i].name);
+			opt_showall = 1;
+			break;
+		case 'D':
+			opt_dac_stream = strdup(optarg);
+			break;
+		case 'r':
+			opt_rate = atoi(optarg);
+			if (opt_rate < 1 || opt_rate > 1000000) {
+				fprintf(stderr, "Invalid rate\n");
+				return 1;
 			}
-			printf("\nFPGA Inputs:\n");
-			for (i = 0; cbar_inputs[i].name != 0; i++) {
-				printf("%s\n", cbar_inputs[i].name);
+			break;
+		case 'y':
+			opt_slew = atoi(optarg);
+			if (opt_slew < 1) {
+				fprintf(stderr, "Invalid slew rate\n");
+				return 1;
 			}
 			break;
+		case 'C':
+			opt_capture = strdup(optarg);
+			break;
+		case 'n':
+			opt_samples = atol(optarg);
+			break;
+		case 'G':
+			opt_gpio_get = 1;
+			break;
+		case 'O':
+			opt_gpio_set = strdup(optarg);
+			break;
+		case 'P':
+			opt_save_profile = strdup(optarg);
+			break;
+		case 'A':
+			opt_apply_profile = strdup(optarg);
+			break;
 		case 'l':
 			opt_setmac = 1;
 			opt_mac = strdup(optarg);
@@ -280,18 +1719,95 @@ int main(int argc, char **argv)
 		case 'j': //LS 1 to allow setting to 0
 			opt_dac3 = ((strtoul(optarg, NULL, 0) & 0xfff)<<1)|0x1;
 			break;
+		case 'B':
+			opt_batch = strdup(optarg);
+			break;
+		case 'k':
+			opt_backend = strdup(optarg);
+			break;
+		case 'T':
+			opt_trace = 1;
+			break;
+		case 'w':
+			opt_watch = strdup(optarg);
+			break;
+		case 'I':
+			opt_interval = atoi(optarg);
+			if (opt_interval < 0) {
+				fprintf(stderr, "Invalid interval %s\n",
+				  optarg);
+				return 1;
+			}
+			break;
+		case 'S':
+			opt_stats = 1;
+			break;
 		default:
 			usage(argv);
 			return 1;
 		}
 	}
 
-	twifd = fpga_init(NULL, 0);
+	/* Only --capture samples back to back, the others would spin */
+	if (opt_interval == 0 && (opt_watch || opt_count ||
+	  opt_auto485_watch)) {
+		fprintf(stderr, "--interval must be at least 1 ms except for "
+		  "--capture\n");
+		return 1;
+	}
+
+	if (opt_trace || opt_stats) {
+		if (bustrace_enable(opt_trace ? 4096 : 0))
+			return 1;
+	}
+
+	/* Without an explicit backend, use tshwctld if it is running since it
+	 * already has the bus open and knows the model.
+	 */
+	if (opt_backend == NULL)
+		opt_backend = getenv("FPGA_BACKEND");
+	if (opt_backend && *opt_backend == 0)
+		opt_backend = NULL;
+	if (opt_backend)
+		twifd = fpga_open(opt_backend);
+	else
+		twifd = fpga_connect(NULL);
+	if (twifd != -1)
+		model = fpga_model(twifd);
+	if (!model)
+		model = get_model();
+	cbar = cbar_get_model(model);
+	if (cbar == NULL) {
+		fprintf(stderr, "Unsupported model TS-%X\n", model);
+		return 1;
+	}
+
+	if (twifd == -1 && opt_backend == NULL)
+		twifd = fpga_init(NULL, 0);
 	if (twifd == -1) {
 		perror("Can't open FPGA I2C bus");
 		return 1;
 	}
 
+	if (opt_showall) {
+		printf("FPGA Outputs:\n");
+		for (i = 0; i < cbar->noutputs; i++) {
+			printf("%s\n", cbar->outputs[i].name);
+		}
+		printf("\nFPGA Inputs:\n");
+		for (i = 0; i < cbar->ninputs; i++) {
+			printf("%s\n", cbar->inputs[i].name);
+		}
+	}
+
+	if (opt_info || opt_modbuspoweron || opt_modbuspoweroff) {
+		chip = gpiod_chip_open_by_number(1);
+		if (chip == NULL) {
+			fprintf(stderr, "Unable to open GPIO chip\n");
+			return 1;
+		}
+	}
+
 
 	if (opt_info) {
 		printf("model=0x%X\n", model);
@@ -312,61 +1828,92 @@ int main(int argc, char **argv)
 		gpiod_line_release(line_bootmode);
 	}
 
+	if (opt_get || opt_set || opt_dump || opt_save_profile ||
+	  opt_apply_profile) {
+		if (cbar_load())
+			return 1;
+	}
+
 	if (opt_get) {
-		for (i = 0; cbar_outputs[i].name != 0; i++)
+		for (i = 0; i < cbar->noutputs; i++)
 		{
-			uint8_t mode = (fpeek8(twifd, cbar_outputs[i].addr)
-			  >> (8 - cbar_size));
-			printf("%s=%s\n", cbar_outputs[i].name,
-			  cbar_inputs[mode].name);
+			char input[TSHWCTLD_MAX_DATA + 1];
+			int value;
+
+			if (fpga_is_remote()) {
+				if (fpga_remote_cbar(twifd, TSHWCTLD_CBAR_GET,
+				  cbar->outputs[i].name, input,
+				  sizeof(input)))
+					return 1;
+				printf("%s=%s\n", cbar->outputs[i].name,
+				  input);
+				continue;
+			}
+			value = fpga_cache_peek(twifd, cbar->outputs[i].addr);
+			if (value < 0)
+				return 1;
+			printf("%s=%s\n", cbar->outputs[i].name,
+			  cbar_mode_name(value));
 		}
 	}
 
 	if (opt_set) {
-		for (i = 0; cbar_outputs[i].name != 0; i++)
+		for (i = 0; i < cbar->noutputs; i++)
 		{
-			char *value = getenv(cbar_outputs[i].name);
-			int j;
-			if(value != NULL) {
-				for (j = 0; cbar_inputs[j].name != 0; j++) {
-					if(strcmp(cbar_inputs[j].name, value)
-					  == 0) {
-						int mode = cbar_inputs[j].addr;
-						uint8_t val = fpeek8(twifd,
-						  cbar_outputs[i].addr);
-						fpoke8(twifd,
-						  cbar_outputs[i].addr,
-						  ((mode << (8 - cbar_size)) |
-						  (val & cbar_mask)));
-						break;
-					}
-				}
-				if(cbar_inputs[i].name == 0) {
-					fprintf(stderr,
-					  "Invalid value \"%s\" for input %s\n",
-					  value, cbar_outputs[i].name);
-				}
-			}
+			const char *value = getenv(cbar->outputs[i].name);
+			if(value != NULL &&
+			  cbar_assign(cbar->outputs[i].name, value))
+				ret = 1;
+		}
+		if (fpga_cache_flush(twifd))
+			ret = 1;
+	}
+
+	if (opt_apply_profile) {
+		if (cbar_apply_profile(opt_apply_profile))
+			return 1;
+	}
+
+	if (opt_save_profile) {
+		if (cbar_save_profile(opt_save_profile))
+			return 1;
+	}
+
+	if (opt_gpio_set) {
+		if (gpio_set(opt_gpio_set))
+			return 1;
+	}
+
+	if (opt_gpio_get) {
+		uint32_t dir, val;
+
+		if (cbar_gpio_read(cbar, twifd, &dir, &val))
+			return 1;
+		for (i = 0; i < cbar->gpio_count; i++) {
+			const char *name = cbar->outputs[i].name;
+
+			printf("%s=%d\n", name, (val >> i) & 1);
+			printf("%s_DIR=%s\n", name,
+			  (dir >> i) & 1 ? "out" : "in");
 		}
 	}
 
 	if (opt_dump) {
-		i = 0;
 		printf("%13s (DIR) (VAL) FPGA Input\n", "FPGA Pad");
-		for (i = 0; cbar_outputs[i].name != 0; i++)
+		for (i = 0; i < cbar->noutputs; i++)
 		{
-			uint8_t value = fpeek8(twifd, cbar_outputs[i].addr);
-			uint8_t mode = value >> (8 - cbar_size);
+			uint8_t value = fpga_cache_peek(twifd,
+			  cbar->outputs[i].addr);
 			char *dir = value & 0x1 ? "out" : "in";
 			int val;
 
-			if(value & 0x1 || cbar_size == 6) {
+			if(value & 0x1 || cbar->size == 6) {
 				val = value & 0x2 ? 1 : 0;
 			} else {
 				val = value & 0x4 ? 1 : 0;
 			}
-			printf("%13s (%3s) (%3d) %s\n",	cbar_outputs[i].name,
-			  dir, val, cbar_inputs[mode].name);
+			printf("%13s (%3s) (%3d) %s\n", cbar->outputs[i].name,
+			  dir, val, cbar_mode_name(value));
 		}
 	}
 
@@ -383,7 +1930,8 @@ int main(int argc, char **argv)
 		}
 
 		if (gpiod_line_request_output(line_modbus_3vn, "tshwctl", 1) ||
-		    gpiod_line_request_input(line_modbus_fault, "tshwctl") ||
+		    gpiod_line_request_both_edges_events(line_modbus_fault,
+		      "tshwctl") ||
 		    gpiod_line_request_output(line_modbus_24v, "tshwctl", 0)) {
 			fprintf(stderr, "Unable to request MODBUS lines\n");
 			return 1;
@@ -391,18 +1939,18 @@ int main(int argc, char **argv)
 	}
 
 	if (opt_modbuspoweron) {
-		/* Enable 3.3 V test, wait for settle, and test the fault IO.
-		 * If no fault, then enable higher 24 V power to MODBUS device.
+		/* Enable 3.3 V test, wait for the fault IO to settle low. If
+		 * no fault, then enable higher 24 V power to MODBUS device.
 		 */
-		gpiod_line_set_value(line_modbus_3vn, 0);
-		usleep(10000);
-		if (gpiod_line_get_value(line_modbus_fault)) {
-			gpiod_line_set_value(line_modbus_3vn, 1);
-			printf("modbuspoweron=0\n");
-		} else {
-			gpiod_line_set_value(line_modbus_3vn, 1);
-			gpiod_line_set_value(line_modbus_24v, 1);
+		if (modbus_poweron(line_modbus_3vn, line_modbus_fault,
+		  line_modbus_24v, opt_modbus_settle, opt_modbus_timeout)) {
 			printf("modbuspoweron=1\n");
+			fflush(stdout);
+			if (opt_modbus_monitor &&
+			  modbus_monitor(line_modbus_fault, line_modbus_24v))
+				ret = 1;
+		} else {
+			printf("modbuspoweron=0\n");
 		}
 	}
 
@@ -425,23 +1973,59 @@ int main(int argc, char **argv)
 	}
 
 	if (opt_peek && opt_addr) {
-		printf("0x%X\n", fpeek8(twifd, addr));
+		if (addr_end == addr) {
+			printf("0x%X\n", fpeek8(twifd, addr));
+		} else {
+			int len = (addr_end - addr) + 1;
+			uint8_t *buf = malloc(len);
+
+			assert(buf != NULL);
+			if (fpeek_block(twifd, addr, buf, len)) {
+				fprintf(stderr, "Unable to read 0x%X-0x%X\n",
+				  addr, addr_end);
+				free(buf);
+				return 1;
+			}
+			hexdump(addr, buf, len);
+			free(buf);
+		}
 	}
 
 	if (opt_auto485 > -1) {
-		auto485_en(opt_auto485, baud, uartmode);
+		if (opt_auto485_watch) {
+			if (run_auto485_watch(opt_auto485, opt_tty,
+			  opt_interval < 0 ? 1000 : opt_interval))
+				return 1;
+		} else {
+			if (auto485_en(opt_auto485, baud, uartmode, opt_tty) ||
+			  fpga_cache_flush(twifd))
+				return 1;
+		}
 	}
 
 	if (opt_cputemp) {
 		signed int temp[2] = {0,0}, x;
 		volatile unsigned int *mxlradcregs;
+		struct adcwait w;
 		int devmem;
 
+		x = iio_backend(getenv("ADC_BACKEND"));
+		if (x == -1)
+			return 1;
+		if (x) {
+			if (cputemp_iio(&temp[0]))
+				return 1;
+			goto cputemp_print;
+		}
+
 		devmem = open("/dev/mem", O_RDWR|O_SYNC);
 		assert(devmem != -1);
 		mxlradcregs = (unsigned int *) mmap(0, getpagesize(),
 		  PROT_READ | PROT_WRITE, MAP_SHARED, devmem, 0x80050000);
 
+		adcwait_open(&w, "mxs-lradc");
+		adcwait_irq_enable(&w, &mxlradcregs[0x14/4],
+		  &mxlradcregs[0x18/4], 0x3 << 16); //Ch0/1 IRQ enable
 		mxlradcregs[0x148/4] = 0xFF;
 		mxlradcregs[0x144/4] = 0x98; //Set to temp sense mode
 		mxlradcregs[0x28/4] = 0x8300; //Enable temp sense block
@@ -456,16 +2040,25 @@ int main(int argc, char **argv)
 			 * Pull out samples*/
 			mxlradcregs[0x18/4] = 0x3;
 			mxlradcregs[0x4/4] = 0x3;
-			while (!((mxlradcregs[0x10/4] & 0x3) == 0x3)) ;
+			if (adcwait(&w, &mxlradcregs[0x10/4], 0x3,
+			  LRADC_TIMEOUT_US)) {
+				fprintf(stderr, "LRADC conversion timed out\n");
+				adcwait_close(&w);
+				return 1;
+			}
 			temp[0] += mxlradcregs[0x60/4] & 0xFFFF;
 			temp[1] += mxlradcregs[0x50/4] & 0xFFFF;
 		}
+		if (opt_stats)
+			adcwait_stats(&w, "lradc", stderr);
+		adcwait_close(&w);
+		munmap((void *)mxlradcregs, getpagesize());
+		close(devmem);
+
+cputemp_print:
 		temp[0] = (((temp[0] - temp[1]) * (1012/4)) - 2730000);
 		printf("internal_temp=%d.%d\n",temp[0] / 10000,
 		  abs(temp[0] % 10000));
-
-		munmap((void *)mxlradcregs, getpagesize());
-		close(devmem);
 	}
 
 	if (opt_setmac) {
@@ -540,41 +2133,65 @@ int main(int argc, char **argv)
 	/* On the TS-7682, these regs are reserverd and writing/reading will
 	 * have no effect.
 	 */
-	if (opt_dac0) {
-		char buf[2];
-		buf[0] = ((opt_dac0 >> 9) & 0xf);
-		buf[1] = ((opt_dac0 >> 1) & 0xff);
-		fpoke8(twifd, 0x2E, buf[0]);
-		fpoke8(twifd, 0x2F, buf[1]);
+	if (opt_dac0 || opt_dac1 || opt_dac2 || opt_dac3) {
+		int i, dacs[DAC_COUNT];
+
+		/* Zero is unset, the values carry a 1 in bit 0 */
+		dacs[0] = opt_dac0 ? opt_dac0 >> 1 : -1;
+		dacs[1] = opt_dac1 ? opt_dac1 >> 1 : -1;
+		dacs[2] = opt_dac2 ? opt_dac2 >> 1 : -1;
+		dacs[3] = opt_dac3 ? opt_dac3 >> 1 : -1;
+		if (opt_slew) {
+			if (dac_init(twifd) ||
+			  dac_ramp(twifd, dacs, opt_slew, opt_rate)) {
+				fprintf(stderr, "DAC ramp failed\n");
+				return 1;
+			}
+		} else {
+			for (i = 0; i < DAC_COUNT; i++) {
+				if (dacs[i] >= 0)
+					dac_set(i, dacs[i]);
+			}
+			if (dac_flush(twifd))
+				return 1;
+		}
+	}
+
+	if (opt_dac_stream) {
+		if (run_dac_stream(opt_dac_stream, opt_rate))
+			return 1;
 	}
 
-	if (opt_dac1) {
-		char buf[2];
-		buf[0] = ((opt_dac1 >> 9) & 0xf);
-		buf[1] = ((opt_dac1 >> 1) & 0xff);
-		fpoke8(twifd, 0x30, buf[0]);
-		fpoke8(twifd, 0x31, buf[1]);
+	if (opt_batch) {
+		if (run_batch(opt_batch))
+			return 1;
 	}
 
-	if (opt_dac2) {
-		char buf[2];
-		buf[0] = ((opt_dac2 >> 9) & 0xf);
-		buf[1] = ((opt_dac2 >> 1) & 0xff);
-		fpoke8(twifd, 0x32, buf[0]);
-		fpoke8(twifd, 0x33, buf[1]);
+	if (opt_watch) {
+		if (run_watch(opt_watch, opt_interval < 0 ? 1000 :
+		  opt_interval))
+			return 1;
 	}
 
-	if (opt_dac3) {
-		char buf[2];
-		buf[0] = ((opt_dac3 >> 9) & 0xf);
-		buf[1] = ((opt_dac3 >> 1) & 0xff);
-		fpoke8(twifd, 0x34, buf[0]);
-		fpoke8(twifd, 0x35, buf[1]);
+	if (opt_count) {
+		if (run_count(opt_count, opt_interval < 0 ? 1000 :
+		  opt_interval, opt_samples))
+			return 1;
 	}
 
+	if (opt_capture) {
+		if (run_capture(opt_capture, opt_interval < 0 ? 0 :
+		  opt_interval, opt_samples))
+			return 1;
+	}
 
-	close(twifd);
+	fpga_close(twifd);
 
-	return 0;
+	if (opt_trace)
+		bustrace_dump(stderr);
+	if (opt_stats)
+		bustrace_stats(stderr);
+
+	return ret;
 }
 
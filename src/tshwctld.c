@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+/* Keeps the FPGA I2C bus open and serves register access to tshwctl and other
+ * clients over a local Unix socket, see tshwctld.h for the protocol. It also
+ * looks up and assigns crossbar routes by name from the crossbar tables it
+ * keeps resident. Requests are handled one at a time, so each request is
+ * atomic with respect to every other client of the daemon.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "crossbar.h"
+#include "fpga.h"
+#include "tshwctld.h"
+
+#define MAX_CLIENTS	32
+
+static int twifd;
+static uint32_t model;
+static const struct cbar_model *cbar;
+static volatile sig_atomic_t done;
+
+const char copyright[] = "Copyright (c) embeddedTS - " __DATE__ " - "
+  GITCOMMIT;
+
+int get_model()
+{
+	FILE *proc;
+	char mdl[256];
+	char *ptr;
+
+	proc = fopen("/proc/device-tree/model", "r");
+	if (!proc) {
+		perror("model");
+		return 0;
+	}
+	fread(mdl, 256, 1, proc);
+	ptr = strstr(mdl, "TS-");
+	return strtoull(ptr+3, NULL, 16);
+}
+
+static void sig_done(int sig)
+{
+	done = 1;
+}
+
+/* Handles TSHWCTLD_CBAR_GET/SET, name is the request data as a string */
+static int handle_cbar(int cmd, char *name, struct tshwctld_resp *resp)
+{
+	const struct cbarpin *out, *in;
+	const char *input;
+	char *eq = NULL;
+	uint8_t value;
+
+	if (cmd == TSHWCTLD_CBAR_SET) {
+		eq = strchr(name, '=');
+		if (eq == NULL)
+			return EINVAL;
+		*eq = 0;
+	}
+	out = cbar_find_output(cbar, name);
+	if (out == NULL)
+		return ENOENT;
+	if (fpeek_block(twifd, out->addr, &value, 1))
+		return EIO;
+
+	if (cmd == TSHWCTLD_CBAR_GET) {
+		input = cbar_input_name(cbar, value >> (8 - cbar->size));
+		if (input == NULL)
+			input = "UNKNOWN";
+		resp->len = strlen(input);
+		memcpy(resp->data, input, resp->len);
+		return 0;
+	}
+
+	in = cbar_find_input(cbar, eq + 1);
+	if (in == NULL)
+		return ENOENT;
+	value = (value & cbar->mask) | (in->addr << (8 - cbar->size));
+	if (fpoke_block(twifd, out->addr, &value, 1))
+		return EIO;
+
+	return 0;
+}
+
+/* Returns -1 once the client has gone away */
+static int handle_request(int fd)
+{
+	struct tshwctld_req req;
+	struct tshwctld_resp resp;
+	char name[TSHWCTLD_MAX_DATA + 1];
+	ssize_t r;
+
+	r = recv(fd, &req, sizeof(req), 0);
+	if (r <= 0)
+		return -1;
+	if (r < TSHWCTLD_REQ_HDR)
+		return 0;
+
+	resp.status = 0;
+	resp.len = 0;
+
+	switch (req.cmd) {
+	  case TSHWCTLD_INFO:
+		resp.len = sizeof(model);
+		memcpy(resp.data, &model, sizeof(model));
+		break;
+	  case TSHWCTLD_READ:
+		if (fpeek_block(twifd, req.addr, resp.data, req.len))
+			resp.status = EIO;
+		else
+			resp.len = req.len;
+		break;
+	  case TSHWCTLD_WRITE:
+		if (r != TSHWCTLD_REQ_HDR + req.len)
+			resp.status = EINVAL;
+		else if (fpoke_block(twifd, req.addr, req.data, req.len))
+			resp.status = EIO;
+		break;
+	  case TSHWCTLD_CBAR_GET:
+	  case TSHWCTLD_CBAR_SET:
+		if (r != TSHWCTLD_REQ_HDR + req.len) {
+			resp.status = EINVAL;
+			break;
+		}
+		memcpy(name, req.data, req.len);
+		name[req.len] = 0;
+		resp.status = handle_cbar(req.cmd, name, &resp);
+		break;
+	  default:
+		resp.status = EINVAL;
+		break;
+	}
+
+	if (send(fd, &resp, TSHWCTLD_RESP_HDR + resp.len, MSG_NOSIGNAL) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void usage(char **argv) {
+	fprintf(stderr,
+	  "%s\n\n"
+	  "Usage: %s [OPTIONS] ...\n"
+	  "embeddedTS I2C FPGA access daemon\n"
+	  "\n"
+	  "  -s, --socket <path>    Listen on <path> instead of %s\n"
+	  "  -k, --backend <spec>   FPGA access backend, see tshwctl --help\n"
+	  "  -f, --foreground       Do not detach from the terminal\n"
+	  "  -h, --help             This message\n"
+	  "\n",
+	  copyright, argv[0], TSHWCTLD_SOCKET
+	);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, nfds, lfd;
+	int opt_foreground = 0;
+	char *opt_backend = NULL;
+	char *sockpath = TSHWCTLD_SOCKET;
+	struct sockaddr_un sun;
+	struct pollfd fds[MAX_CLIENTS + 1];
+
+	static struct option long_options[] = {
+		{ "socket", 1, 0, 's' },
+		{ "backend", 1, 0, 'k' },
+		{ "foreground", 0, 0, 'f' },
+		{ "help", 0, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while((c = getopt_long(argc, argv, "s:k:fh", long_options, NULL)) != -1) {
+		switch(c) {
+		case 's':
+			sockpath = strdup(optarg);
+			break;
+		case 'k':
+			opt_backend = strdup(optarg);
+			break;
+		case 'f':
+			opt_foreground = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (opt_backend == NULL)
+		opt_backend = getenv("FPGA_BACKEND");
+	if (opt_backend && *opt_backend == 0)
+		opt_backend = NULL;
+	if (opt_backend)
+		twifd = fpga_open(opt_backend);
+	else
+		twifd = fpga_init(NULL, 0);
+	if (twifd == -1) {
+		perror("Can't open FPGA I2C bus");
+		return 1;
+	}
+
+	model = fpga_model(twifd);
+	if (!model)
+		model = get_model();
+	cbar = cbar_get_model(model);
+	if (cbar == NULL) {
+		fprintf(stderr, "Unsupported model TS-%X\n", model);
+		return 1;
+	}
+
+	lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (lfd == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, sockpath, sizeof(sun.sun_path) - 1);
+	unlink(sockpath);
+	if (bind(lfd, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+	  listen(lfd, 8) == -1) {
+		perror(sockpath);
+		return 1;
+	}
+	/* Access to the socket is access to the FPGA, same as /dev/i2c-0 */
+	chmod(sockpath, 0660);
+
+	if (!opt_foreground && daemon(0, 0) == -1) {
+		perror("daemon");
+		return 1;
+	}
+
+	signal(SIGINT, sig_done);
+	signal(SIGTERM, sig_done);
+	signal(SIGPIPE, SIG_IGN);
+
+	fds[0].fd = lfd;
+	fds[0].events = POLLIN;
+	nfds = 1;
+
+	while (!done) {
+		if (poll(fds, nfds, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = nfds - 1; i > 0; i--) {
+			if (!fds[i].revents)
+				continue;
+			if (handle_request(fds[i].fd) == -1) {
+				close(fds[i].fd);
+				fds[i] = fds[--nfds];
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int cfd = accept(lfd, NULL, NULL);
+
+			if (cfd != -1) {
+				if (nfds > MAX_CLIENTS) {
+					close(cfd);
+				} else {
+					fds[nfds].fd = cfd;
+					fds[nfds].events = POLLIN;
+					nfds++;
+				}
+			}
+		}
+	}
+
+	unlink(sockpath);
+	fpga_close(twifd);
+
+	return 0;
+}
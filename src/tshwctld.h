@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/* Copyright (c) 2019-2022 Technologic Systems, Inc. dba embeddedTS */
+
+#ifndef __TSHWCTLD_H_
+#define __TSHWCTLD_H_
+
+#include <stdint.h>
+
+/* tshwctld listens on a SOCK_SEQPACKET Unix socket. Every request is a single
+ * packet and is answered with a single packet, so no additional framing is
+ * needed. All multi-byte fields are in host byte order.
+ */
+#define TSHWCTLD_SOCKET		"/run/tshwctld.sock"
+#define TSHWCTLD_MAX_DATA	255
+
+/* The crossbar requests take names as in tshwctl --get/--set, without a
+ * terminating NUL, and fail with ENOENT for an unknown pad or input. The
+ * daemon does the name lookup and the read-modify-write of the pad
+ * register, so a client can reroute a pad without its own copy of the
+ * crossbar tables and without racing another client's change.
+ */
+
+enum {
+	TSHWCTLD_INFO = 1,	/* Returns the board model as a uint32_t */
+	TSHWCTLD_READ,		/* Reads len registers starting at addr */
+	TSHWCTLD_WRITE,		/* Writes len registers starting at addr */
+	TSHWCTLD_CBAR_GET,	/* data is a pad name, returns its input */
+	TSHWCTLD_CBAR_SET,	/* data is "PAD=INPUT", routes it */
+};
+
+struct tshwctld_req {
+	uint8_t cmd;
+	uint8_t len;
+	uint16_t addr;
+	uint8_t data[TSHWCTLD_MAX_DATA];
+} __attribute__((packed));
+
+struct tshwctld_resp {
+	uint8_t status;		/* 0 on success, errno otherwise */
+	uint8_t len;
+	uint8_t data[TSHWCTLD_MAX_DATA];
+} __attribute__((packed));
+
+#define TSHWCTLD_REQ_HDR	4
+#define TSHWCTLD_RESP_HDR	2
+
+#endif
@@ -15,6 +15,8 @@
 #include <getopt.h>
 #endif
 
+#include "buslock.h"
+#include "bustrace.h"
 #include "i2c-dev.h"
 
 const char copyright[] = "Copyright (c) embeddedTS - " __DATE__ " - "
@@ -54,6 +56,35 @@ int silabs_init()
 	return fd;
 }
 
+/* The microcontroller has no register addressing, every transfer starts at
+ * its first byte.
+ */
+int silabs_read(int twifd, uint8_t *data, int len)
+{
+	uint64_t start = BUSTRACE_BEGIN();
+	int ret;
+
+	buslock_acquire();
+	ret = read(twifd, data, len);
+	buslock_release();
+
+	BUSTRACE_END(start, 0x78, 0, BUSTRACE_READ, len, ret != len);
+	return ret;
+}
+
+int silabs_write(int twifd, uint8_t *data, int len)
+{
+	uint64_t start = BUSTRACE_BEGIN();
+	int ret;
+
+	buslock_acquire();
+	ret = write(twifd, data, len);
+	buslock_release();
+
+	BUSTRACE_END(start, 0x78, 0, BUSTRACE_WRITE, len, ret != len);
+	return ret;
+}
+
 #ifdef CTL
 
 void do_info(int twifd)
@@ -61,7 +92,7 @@ void do_info(int twifd)
 	uint8_t data[28];
 	unsigned int pct;
 	bzero(data, 28);
-	read(twifd, data, 28);
+	silabs_read(twifd, data, 28);
 
 	printf("revision=0x%x\n", (data[16] >> 4) & 0xF);
 	printf("P1_2=0x%x\n", data[0]<<8|data[1]);
@@ -126,6 +157,8 @@ static void usage(char **argv) {
 	  "  -m, --resetswitchwkup   Wake up at reset switch is press\n"
 	  "  -X, --resetswitchon     Enable reset switch\n"
 	  "  -Y, --resetswitchoff    Disable reset switch\n"
+	  "  -T, --trace             Print every bus transaction to stderr\n"
+	  "  -S, --stats             Print bus transaction totals to stderr\n"
 	  "  -h, --help              This message\n",
 	  copyright, argv[0]
 	);
@@ -137,6 +170,7 @@ int main(int argc, char **argv)
 	int twifd;
 	int opt_resetswitch = 0, opt_sleepmode = 0, opt_timewkup = 0xffffff;
 	int opt_resetswitchwkup = 0;
+	int opt_info = 0, opt_trace = 0, opt_stats = 0;
 
 	static struct option long_options[] = {
 	  { "info", 0, 0, 'i' },
@@ -145,6 +179,8 @@ int main(int argc, char **argv)
 	  { "resetswitchwkup", 0, 0, 'm'},
 	  { "resetswitchon", 0, 0, 'X'},
 	  { "resetswitchoff", 0, 0, 'Y'},
+	  { "trace", 0, 0, 'T'},
+	  { "stats", 0, 0, 'S'},
 	  { "help", 0, 0, 'h' },
 	  { 0, 0, 0, 0 }
 	};
@@ -171,11 +207,11 @@ int main(int argc, char **argv)
 
 
 	while((c = getopt_long(argc, argv,
-	  "iLM:XYhm",
+	  "iLM:XYhmTS",
 	  long_options, NULL)) != -1) {
 		switch (c) {
 		  case 'i':
-			do_info(twifd);
+			opt_info = 1;
 			break;
 		  case 'L':
 			opt_sleepmode = 1;
@@ -192,6 +228,12 @@ int main(int argc, char **argv)
 		  case 'Y':
 			opt_resetswitch = 1;
 			break;
+		  case 'T':
+			opt_trace = 1;
+			break;
+		  case 'S':
+			opt_stats = 1;
+			break;
 		  case 'h':
 		  default:
 			usage(argv);
@@ -199,11 +241,19 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if(opt_trace || opt_stats) {
+		if(bustrace_enable(opt_trace ? 1024 : 0))
+			return 1;
+	}
+
+	if(opt_info)
+		do_info(twifd);
+
 	if(opt_resetswitch) {
 		unsigned char dat = 0x40;
 
 		dat |= (opt_resetswitch & 0x2); //0x40 for off, 0x42 on
-		write(twifd, &dat, 1);
+		silabs_write(twifd, &dat, 1);
 	}
 
 	if(opt_sleepmode) {
@@ -214,9 +264,13 @@ int main(int argc, char **argv)
 		dat[3] = (opt_timewkup & 0xff);
 		dat[2] = ((opt_timewkup >> 8) & 0xff);
 		dat[1] = ((opt_timewkup >> 16) & 0xff);
-		write(twifd, &dat, 4);
+		silabs_write(twifd, dat, 4);
 	}
 
+	if(opt_trace)
+		bustrace_dump(stderr);
+	if(opt_stats)
+		bustrace_stats(stderr);
 
 	return 0;
 }